@@ -0,0 +1,259 @@
+#ifndef __wasm__
+// for MAP_ANONYMOUS and MADV_HUGEPAGE
+#define _DEFAULT_SOURCE
+#endif
+#include "alloc.h"
+#ifdef __wasm__
+#include "wasm_libc.h"
+#else
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
+
+#define CSAND_ALIGN_UP(size) (((size) + CSAND_ALLOC_ALIGNMENT - 1) & ~(size_t)(CSAND_ALLOC_ALIGNMENT - 1))
+// the usual size of a huge page on x86-64 and arm64
+#define CSAND_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+#if !defined(__wasm__) && defined(MADV_HUGEPAGE)
+#define CSAND_HAVE_HUGE_PAGES
+#endif
+
+struct CsandPoolSlab {
+    CsandPoolSlab *next;
+};
+
+struct CsandArenaBlock {
+    CsandArenaBlock *next;
+    size_t size;
+};
+
+#define CSAND_POOL_SLAB_HEADER_SIZE CSAND_ALIGN_UP(sizeof(CsandPoolSlab))
+#define CSAND_ARENA_BLOCK_HEADER_SIZE CSAND_ALIGN_UP(sizeof(CsandArenaBlock))
+
+bool csandBudgetCharge(CsandMemoryBudget *budget, size_t size) {
+    if (budget == NULL) {
+        return true;
+    }
+
+    if (budget->limit != 0 && budget->used + size > budget->limit) {
+        return false;
+    }
+
+    budget->used += size;
+    return true;
+}
+
+void csandBudgetRelease(CsandMemoryBudget *budget, size_t size) {
+    if (budget != NULL) {
+        budget->used -= size;
+    }
+}
+
+// takes size bytes from malloc, but only if the budget allows it
+static void *csandBudgetAlloc(CsandMemoryBudget *budget, size_t size) {
+    if (!csandBudgetCharge(budget, size)) {
+        return NULL;
+    }
+
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        csandBudgetRelease(budget, size);
+    }
+
+    return ptr;
+}
+
+#ifdef CSAND_HAVE_HUGE_PAGES
+// maps a bit more than asked for and trims it, so the slab starts on a huge page boundary
+static void *csandHugeAlloc(CsandMemoryBudget *budget) {
+    if (!csandBudgetCharge(budget, CSAND_HUGE_PAGE_SIZE)) {
+        return NULL;
+    }
+
+    size_t map_size = 2 * CSAND_HUGE_PAGE_SIZE;
+    unsigned char *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        csandBudgetRelease(budget, CSAND_HUGE_PAGE_SIZE);
+        return NULL;
+    }
+
+    size_t head = (CSAND_HUGE_PAGE_SIZE - (uintptr_t)map % CSAND_HUGE_PAGE_SIZE) % CSAND_HUGE_PAGE_SIZE;
+    if (head != 0) {
+        munmap(map, head);
+    }
+    munmap(map + head + CSAND_HUGE_PAGE_SIZE, CSAND_HUGE_PAGE_SIZE - head);
+
+    // only a hint, without it the slab is still usable with normal pages
+    madvise(map + head, CSAND_HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+    return map + head;
+}
+#endif
+
+static void *csandPoolAllocSlab(CsandPool *pool, size_t slab_size) {
+#ifdef CSAND_HAVE_HUGE_PAGES
+    if (pool->huge_pages) {
+        return csandHugeAlloc(pool->budget);
+    }
+#endif
+
+    return csandBudgetAlloc(pool->budget, slab_size);
+}
+
+static void csandPoolFreeSlab(CsandPool *pool, CsandPoolSlab *slab, size_t slab_size) {
+#ifdef CSAND_HAVE_HUGE_PAGES
+    if (pool->huge_pages) {
+        munmap(slab, CSAND_HUGE_PAGE_SIZE);
+        csandBudgetRelease(pool->budget, CSAND_HUGE_PAGE_SIZE);
+        return;
+    }
+#endif
+
+    free(slab);
+    csandBudgetRelease(pool->budget, slab_size);
+}
+
+void csandPoolInit(CsandPool *pool, size_t block_size, size_t blocks_per_slab, CsandMemoryBudget *budget) {
+    // free blocks store the free list link in themselves
+    if (block_size < sizeof(void *)) {
+        block_size = sizeof(void *);
+    }
+
+    pool->block_size = CSAND_ALIGN_UP(block_size);
+    pool->blocks_per_slab = blocks_per_slab;
+    pool->huge_pages = false;
+    pool->budget = budget;
+    pool->slabs = NULL;
+    pool->free_blocks = NULL;
+    pool->blocks_used = 0;
+}
+
+void csandPoolDestroy(CsandPool *pool) {
+    size_t slab_size = CSAND_POOL_SLAB_HEADER_SIZE + pool->block_size * pool->blocks_per_slab;
+
+    while (pool->slabs != NULL) {
+        CsandPoolSlab *next = pool->slabs->next;
+        csandPoolFreeSlab(pool, pool->slabs, slab_size);
+        pool->slabs = next;
+    }
+
+    pool->free_blocks = NULL;
+    pool->blocks_used = 0;
+}
+
+void *csandPoolAlloc(CsandPool *pool) {
+    if (pool->free_blocks == NULL) {
+        size_t slab_size = CSAND_POOL_SLAB_HEADER_SIZE + pool->block_size * pool->blocks_per_slab;
+        CsandPoolSlab *slab = csandPoolAllocSlab(pool, slab_size);
+        if (slab == NULL) {
+            return NULL;
+        }
+
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+
+        // push in reverse, so blocks get handed out in address order
+        unsigned char *blocks = (unsigned char *)slab + CSAND_POOL_SLAB_HEADER_SIZE;
+        for (size_t i = pool->blocks_per_slab; i-- > 0;) {
+            void *block = blocks + i * pool->block_size;
+            *(void **)block = pool->free_blocks;
+            pool->free_blocks = block;
+        }
+    }
+
+    void *block = pool->free_blocks;
+    pool->free_blocks = *(void **)block;
+    pool->blocks_used++;
+
+    return block;
+}
+
+void csandPoolFree(CsandPool *pool, void *block) {
+    if (block == NULL) {
+        return;
+    }
+
+    *(void **)block = pool->free_blocks;
+    pool->free_blocks = block;
+    pool->blocks_used--;
+}
+
+bool csandPoolUseHugePages(CsandPool *pool) {
+#ifdef CSAND_HAVE_HUGE_PAGES
+    size_t blocks_per_slab = (CSAND_HUGE_PAGE_SIZE - CSAND_POOL_SLAB_HEADER_SIZE) / pool->block_size;
+    if (pool->slabs != NULL || blocks_per_slab == 0) {
+        return false;
+    }
+
+    pool->blocks_per_slab = blocks_per_slab;
+    pool->huge_pages = true;
+    return true;
+#else
+    (void)pool;
+    return false;
+#endif
+}
+
+void csandArenaInit(CsandArena *arena, size_t block_size, CsandMemoryBudget *budget) {
+    arena->block_size = block_size;
+    arena->budget = budget;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->offset = 0;
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+void csandArenaDestroy(CsandArena *arena) {
+    while (arena->first != NULL) {
+        CsandArenaBlock *next = arena->first->next;
+        csandBudgetRelease(arena->budget, CSAND_ARENA_BLOCK_HEADER_SIZE + arena->first->size);
+        free(arena->first);
+        arena->first = next;
+    }
+
+    arena->current = NULL;
+    arena->offset = 0;
+    arena->used = 0;
+}
+
+void *csandArenaAlloc(CsandArena *arena, size_t size) {
+    size = CSAND_ALIGN_UP(size);
+
+    for (;;) {
+        CsandArenaBlock *block = arena->current;
+        if (block != NULL && arena->offset + size <= block->size) {
+            void *ptr = (unsigned char *)block + CSAND_ARENA_BLOCK_HEADER_SIZE + arena->offset;
+            arena->offset += size;
+            arena->used += size;
+            if (arena->used > arena->peak) {
+                arena->peak = arena->used;
+            }
+
+            return ptr;
+        }
+
+        // blocks kept from before the last reset are reused first
+        CsandArenaBlock **next = block != NULL ? &block->next : &arena->first;
+        if (*next == NULL) {
+            size_t block_size = size > arena->block_size ? size : arena->block_size;
+            CsandArenaBlock *new_block = csandBudgetAlloc(arena->budget, CSAND_ARENA_BLOCK_HEADER_SIZE + block_size);
+            if (new_block == NULL) {
+                return NULL;
+            }
+
+            new_block->next = NULL;
+            new_block->size = block_size;
+            *next = new_block;
+        }
+
+        arena->current = *next;
+        arena->offset = 0;
+    }
+}
+
+void csandArenaReset(CsandArena *arena) {
+    arena->current = NULL;
+    arena->offset = 0;
+    arena->used = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef CSAND_ALLOC_H
+#define CSAND_ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define CSAND_ALLOC_ALIGNMENT 16
+
+// shared by pools and arenas that should stay under a common limit
+typedef struct CsandMemoryBudget {
+    // 0 means unlimited
+    size_t limit;
+    size_t used;
+} CsandMemoryBudget;
+
+typedef struct CsandPoolSlab CsandPoolSlab;
+
+/* Hands out blocks of one fixed size. Memory is taken from malloc a slab at
+ * a time and freed blocks are kept for reuse, so slabs only go back to
+ * malloc when the pool is destroyed. */
+typedef struct CsandPool {
+    size_t block_size;
+    size_t blocks_per_slab;
+    // slabs come from mmap instead, see csandPoolUseHugePages
+    bool huge_pages;
+    CsandMemoryBudget *budget;
+    CsandPoolSlab *slabs;
+    void *free_blocks;
+    size_t blocks_used;
+} CsandPool;
+
+typedef struct CsandArenaBlock CsandArenaBlock;
+
+/* Bump allocator for data that lives until the next reset. Resetting keeps
+ * the blocks around, so a steady workload stops allocating after warming up. */
+typedef struct CsandArena {
+    size_t block_size;
+    CsandMemoryBudget *budget;
+    CsandArenaBlock *first;
+    CsandArenaBlock *current;
+    size_t offset;
+    size_t used;
+    size_t peak;
+} CsandArena;
+
+bool csandBudgetCharge(CsandMemoryBudget *budget, size_t size);
+void csandBudgetRelease(CsandMemoryBudget *budget, size_t size);
+
+void csandPoolInit(CsandPool *pool, size_t block_size, size_t blocks_per_slab, CsandMemoryBudget *budget);
+void csandPoolDestroy(CsandPool *pool);
+// returns NULL when malloc or the budget runs out
+void *csandPoolAlloc(CsandPool *pool);
+void csandPoolFree(CsandPool *pool, void *block);
+/* Makes every slab a transparent huge page, so a big pool takes up far
+ * fewer TLB entries. A slab is first touched by whoever grows the pool, so
+ * with the kernel's first-touch policy that's the NUMA node it ends up on.
+ * Only works before the first block is handed out, returns false if it's
+ * too late or huge pages aren't available. */
+bool csandPoolUseHugePages(CsandPool *pool);
+
+void csandArenaInit(CsandArena *arena, size_t block_size, CsandMemoryBudget *budget);
+void csandArenaDestroy(CsandArena *arena);
+// returns NULL when malloc or the budget runs out
+void *csandArenaAlloc(CsandArena *arena, size_t size);
+void csandArenaReset(CsandArena *arena);
+
+#endif
@@ -0,0 +1,143 @@
+/* Times the cell access patterns of the simulation against the chunk layout
+ * the world was built with, with normal and with huge pages. `make bench`
+ * builds it once with rows and once with CSAND_TILED_CHUNKS and runs both.
+ * Only world.c and alloc.c are linked in, the passes below stand in for
+ * csandSimulate. */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include "platform.h"
+#include "world.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// big enough that the cells don't fit in what the TLB covers with normal pages
+#define BENCH_SIZE 4096
+#define BENCH_PASSES 16
+
+enum {
+    BENCH_AIR,
+    BENCH_SAND,
+};
+
+typedef enum {
+    // every grain falls straight down by one cell if it can
+    BENCH_FALL,
+    // every cell looks at its 8 neighbors, like csandCanSettle
+    BENCH_NEIGHBORS,
+    // every cell of a row, left to right
+    BENCH_ROWS,
+    BENCH_PASSES_COUNT,
+} BenchPass;
+
+static const char *const pass_names[BENCH_PASSES_COUNT] = {"fall", "neighbors", "rows"};
+
+// nothing else from the platform is used by world.c
+void csandPlatformPrintErr(const char *str) {
+    fputs(str, stderr);
+}
+
+static double benchNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static unsigned long benchFall(CsandWorld *world) {
+    unsigned long moved = 0;
+    for (unsigned int y = 1; y < BENCH_SIZE; y++) {
+        for (unsigned int x = 0; x < BENCH_SIZE; x++) {
+            unsigned char *cell = csandWorldCell(world, x, y);
+            unsigned char *below = csandWorldCell(world, x, y - 1);
+            if (*cell == BENCH_SAND && *below == BENCH_AIR) {
+                *below = BENCH_SAND;
+                *cell = BENCH_AIR;
+                moved++;
+            }
+        }
+    }
+
+    return moved;
+}
+
+static unsigned long benchNeighbors(CsandWorld *world) {
+    unsigned long sand = 0;
+    for (unsigned int y = 1; y < BENCH_SIZE - 1; y++) {
+        for (unsigned int x = 1; x < BENCH_SIZE - 1; x++) {
+            for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    sand += *csandWorldCell(world, x + dx, y + dy) == BENCH_SAND;
+                }
+            }
+        }
+    }
+
+    return sand;
+}
+
+static unsigned long benchRows(CsandWorld *world) {
+    unsigned long sand = 0;
+    for (unsigned int y = 0; y < BENCH_SIZE; y++) {
+        for (unsigned int x = 0; x < BENCH_SIZE; x++) {
+            sand += *csandWorldCell(world, x, y) == BENCH_SAND;
+        }
+    }
+
+    return sand;
+}
+
+static bool benchRun(bool huge_pages) {
+    static CsandWorld world;
+    if (!csandWorldInit(&world, BENCH_SIZE, BENCH_SIZE, CSAND_WORLD_FORMAT_BYTE)) {
+        fprintf(stderr, "failed to allocate the world\n");
+        return false;
+    }
+
+    if (huge_pages && !csandWorldEnableHugePages(&world)) {
+        printf("no huge pages\n");
+        csandWorldDestroy(&world);
+        return true;
+    }
+
+    // a checkerboard of sand in the top half keeps the fall pass busy for all of its passes
+    for (unsigned int y = 0; y < BENCH_SIZE; y++) {
+        for (unsigned int x = 0; x < BENCH_SIZE; x++) {
+            bool sand = y >= BENCH_SIZE / 2 && (x ^ y) & 1;
+            csandWorldSetMat(&world, x, y, sand ? BENCH_SAND : BENCH_AIR);
+        }
+    }
+
+    const char *layout = CSAND_CHUNK_ROWS_CONTIGUOUS ? "row major" : "tiled";
+    printf("%s chunks, %s pages, %ux%u cells\n", layout, huge_pages ? "huge" : "normal", BENCH_SIZE, BENCH_SIZE);
+    printf("%-10s %10s\n", "pass", "mean ms");
+
+    // the results get printed, so nothing can be optimized out
+    unsigned long checksum = 0;
+    for (int pass = 0; pass < BENCH_PASSES_COUNT; pass++) {
+        double start = benchNow();
+        for (int i = 0; i < BENCH_PASSES; i++) {
+            switch (pass) {
+                case BENCH_FALL:
+                    checksum += benchFall(&world);
+                    break;
+                case BENCH_NEIGHBORS:
+                    checksum += benchNeighbors(&world);
+                    break;
+                case BENCH_ROWS:
+                    checksum += benchRows(&world);
+                    break;
+            }
+        }
+
+        printf("%-10s %10.3f\n", pass_names[pass], (benchNow() - start) / BENCH_PASSES * 1000);
+    }
+
+    printf("checksum %lu\n", checksum);
+    csandWorldDestroy(&world);
+    return true;
+}
+
+int main(void) {
+    return benchRun(false) && benchRun(true) ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+/* Times the wasm_libc memory functions against a plain byte loop. Built on
+ * its own with `make bench_memops.wasm` and run by bench_memops.mjs under
+ * node, so no browser is needed. */
+#include "wasm_libc.h"
+#include <stddef.h>
+
+#define BENCH_MAX_SIZE (1024 * 1024)
+
+typedef enum {
+    BENCH_MEMCPY,
+    BENCH_MEMMOVE,
+    BENCH_MEMSET,
+    BENCH_BYTE_LOOP,
+} BenchOp;
+
+// milliseconds, imported from the runner
+double csandBenchNow(void);
+
+static unsigned char *buffer = NULL;
+
+/* Calling through volatile pointers keeps clang from inlining the functions
+ * or merging the repeated calls. */
+static void *(*volatile bench_memcpy)(void *restrict, const void *restrict, size_t) = memcpy;
+static void *(*volatile bench_memmove)(void *, const void *, size_t) = memmove;
+static void *(*volatile bench_memset)(void *, int, size_t) = memset;
+
+__attribute__((no_builtin)) static void *benchByteLoop(void *restrict dst, const void *restrict src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        ((unsigned char *)dst)[i] = ((const unsigned char *)src)[i];
+    }
+
+    return dst;
+}
+
+static void *(*volatile bench_byte_loop)(void *restrict, const void *restrict, size_t) = benchByteLoop;
+
+__attribute__((export_name("csandBenchMaxSize"))) size_t csandBenchMaxSize(void) {
+    return BENCH_MAX_SIZE;
+}
+
+/* Returns how many milliseconds the iterations took. The source is offset
+ * by a byte so the unaligned paths get exercised too. */
+__attribute__((export_name("csandBenchRun"))) double csandBenchRun(BenchOp op, size_t size, unsigned int iterations) {
+    if (size > BENCH_MAX_SIZE) {
+        return -1.0;
+    }
+
+    if (buffer == NULL) {
+        buffer = malloc(2 * BENCH_MAX_SIZE + 1);
+        if (buffer == NULL) {
+            return -1.0;
+        }
+        memset(buffer, 0, 2 * BENCH_MAX_SIZE + 1);
+    }
+
+    unsigned char *dst = buffer;
+    unsigned char *src = buffer + BENCH_MAX_SIZE + 1;
+
+    double start = csandBenchNow();
+    for (unsigned int i = 0; i < iterations; i++) {
+        switch (op) {
+        case BENCH_MEMCPY:
+            bench_memcpy(dst, src, size);
+            break;
+        case BENCH_MEMMOVE:
+            // overlapping, like the scrolling copies it's used for
+            bench_memmove(dst + 1, dst, size);
+            break;
+        case BENCH_MEMSET:
+            bench_memset(dst, (int)i, size);
+            break;
+        case BENCH_BYTE_LOOP:
+            bench_byte_loop(dst, src, size);
+            break;
+        }
+    }
+
+    return csandBenchNow() - start;
+}
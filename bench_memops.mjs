@@ -0,0 +1,35 @@
+// usage: node bench_memops.mjs [module.wasm...]
+import { readFile } from "node:fs/promises";
+
+const ops = ["memcpy", "memmove", "memset", "byte loop"];
+const sizes = [16, 64, 256, 4096, 65536, 1024 * 1024];
+// bytes each measurement moves, so small sizes don't finish too quickly to time
+const bytes_per_run = 256 * 1024 * 1024;
+
+async function bench(path) {
+    const { instance } = await WebAssembly.instantiate(await readFile(path), {
+        env: { csandBenchNow: () => performance.now() },
+    });
+    const { csandBenchRun, csandBenchMaxSize } = instance.exports;
+    const max_size = Number(csandBenchMaxSize());
+
+    console.log(path);
+    console.log(["size", ...ops].map((column) => column.padStart(12)).join(""));
+    for (const size of sizes.filter((size) => size <= max_size)) {
+        const iterations = Math.max(1, Math.floor(bytes_per_run / size));
+        const row = [String(size)];
+        for (let op = 0; op < ops.length; op++) {
+            // warm up, so the tiers of the engine's compiler are out of the way
+            csandBenchRun(op, size, Math.max(1, iterations >> 4));
+            const ms = csandBenchRun(op, size, iterations);
+            row.push(`${((size * iterations) / (ms * 1e6)).toFixed(2)} GB/s`);
+        }
+        console.log(row.map((column) => column.padStart(12)).join(""));
+    }
+    console.log();
+}
+
+const paths = process.argv.length > 2 ? process.argv.slice(2) : ["bench_memops.wasm"];
+for (const path of paths) {
+    await bench(path);
+}
@@ -1,66 +1,158 @@
+#ifndef __wasm__
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "materials.h"
 #include "nuklear_config.h"
 #include "platform.h"
 #include "random.h"
 #include "renderer.h"
 #include "rgba.h"
+#include "scene.h"
+#include "world.h"
+#ifdef CSAND_THREADS
+#include "thread.h"
+#endif
 #include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#ifdef __wasm__
+#include "wasm_libc.h"
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#endif
 
 #define SPEED_LIMIT 128
 
-enum {
-    MAT_AIR,
-    MAT_WALL,
-    MAT_SAND,
-    MAT_WATER,
-    MAT_FIRE_GAS,
-    MAT_FIRE_POWDER,
-    MAT_FIRE_LIQUID,
-    MAT_SMOKE,
-    MAT_WOOD,
-    MAT_COAL,
-    MAT_OIL,
-    MAT_HYDROGEN_GAS,
-    MAT_HYDROGEN_LIQUID,
-    MAT_UPDATED_BIT = 0x80
-};
-
-#define MATERIALS_COUNT MAT_UPDATED_BIT
-
 #define WIDTH 128
 #define HEIGHT 72
 
+// either can be CSAND_WORLD_UNBOUNDED, the view stays WIDTH x HEIGHT then
+#ifndef WORLD_WIDTH
+#define WORLD_WIDTH WIDTH
+#endif
+
+#ifndef WORLD_HEIGHT
+#define WORLD_HEIGHT HEIGHT
+#endif
+
+#ifndef WORLD_FORMAT
+#define WORLD_FORMAT CSAND_WORLD_FORMAT_BYTE
+#endif
+
 #define TARGET_TICK_DELAY (1.0/60.0 - 0.001)
+#define CAMERA_STEP 16
+
+// the grid is scanned a word at a time to skip over runs that can't change
+#define CSAND_SPAN_LENGTH 8
+#if defined(CSAND_TILED_CHUNKS) && CSAND_SPAN_LENGTH > 1 << CSAND_TILE_SIZE_LOG2
+#error "spans have to fit in a row of a tile"
+#endif
+#define CSAND_SPAN_BYTES(byte) ((CsandSpan)0x0101010101010101 * (byte))
+typedef uint64_t CsandSpan;
+
+typedef enum {
+    CSAND_STATS_NONE,
+    CSAND_STATS_TEXT,
+    CSAND_STATS_JSON,
+} CsandStatsFormat;
+
+// what main was asked to do, the command line can only change it outside the web build
+typedef struct CsandOptions {
+    // nothing but the simulation, no window and no GL
+    bool headless;
+    // either can be CSAND_WORLD_UNBOUNDED
+    unsigned int width;
+    unsigned int height;
+    unsigned long ticks;
+    // seeds the scene and every dice roll of the simulation
+    uint32_t seed;
+    const char *load_path;
+    const char *save_path;
+    bool generate_scene;
+    CsandScene scene;
+    CsandStatsFormat stats;
+} CsandOptions;
 
 static double next_tick_time = 0.0;
 static unsigned int pause = 0;
 static unsigned long speed = 1;
 static unsigned char draw_mat = MAT_SAND;
-static unsigned char data[WIDTH * HEIGHT] = {0};
+static CsandWorld world = {0};
+static CsandVec2Us view_size = {0};
+static CsandVec2Ui camera = {0};
 static bool input_next_frame = false;
 static bool any_nuklear_item_active = false;
 static bool developer_menu_enabled = false;
 static struct nk_rect developer_menu_bounds = {10, 10, 730, 540};
 static float buttons_row_width = 0;
 static bool buttons_shown = true;
-
-typedef struct CsandRenderBuffer {
-    unsigned char *data;
-    unsigned short width;
-    unsigned short height;
-} CsandRenderBuffer;
-
-static CsandRenderBuffer render_buf = {data, WIDTH, HEIGHT};
+// the world in view runs on the gpu, see csandRendererGpuSimStart
+static bool gpu_simulation = false;
+// ticks go through 2x2 blocks instead of single cells, see csandSimulateBlocks
+static bool block_updates = false;
+
+#ifdef CSAND_THREADS
+/* The simulation runs on its own thread, see csandSimulationThread. Whoever
+ * holds world_mutex owns the world, the materials and everything below. */
+static CsandMutex world_mutex = {0};
+// ticks the simulation thread still has to run, only lowered by that thread
+static int32_t pending_ticks = 0;
+// set while the main thread wants the world, so the simulation thread pauses between ticks
+static int32_t render_waiting = 0;
+static bool pending_draw = false;
+static CsandVec2Ui pending_draw_pos = {0};
+static unsigned char pending_draw_mat = MAT_AIR;
+#endif
+
+// every kind gets its own update function, see CSAND_GEN_PARTICLE_KERNEL
+#define CSAND_X_MATERIAL_KINDS(x) \
+    x(SOLID, Solid, "solid") \
+    x(POWDER, Powder, "powder") \
+    x(FLUID, Fluid, "fluid")
+
+#define CSAND_GEN_MATERIAL_KIND_ENUM_ITEM(id, name, label) MAT_KIND_##id,
+#define CSAND_GEN_MATERIAL_KIND_LABEL(id, name, label) label,
 
 typedef enum {
-    MAT_KIND_SOLID,
-    MAT_KIND_POWDER,
-    MAT_KIND_FLUID,
+    CSAND_X_MATERIAL_KINDS(CSAND_GEN_MATERIAL_KIND_ENUM_ITEM)
     MAT_KINDS_COUNT,
 } CsandMaterialKind;
 
+#define CSAND_X_SCAN_ORDERS(x) \
+    /* every row left to right */ \
+    x(LEFT_TO_RIGHT, "LEFT TO RIGHT") \
+    /* each row the other way from the one below it and from the last tick */ \
+    x(ALTERNATING, "ALTERNATING") \
+    /* chunks of a row come in a different order every time and go whichever way */ \
+    x(SHUFFLED, "SHUFFLED")
+
+#define CSAND_GEN_SCAN_ORDER_ENUM_ITEM(id, label) CSAND_SCAN_##id,
+#define CSAND_GEN_SCAN_ORDER_LABEL(id, label) label,
+
+typedef enum {
+    CSAND_X_SCAN_ORDERS(CSAND_GEN_SCAN_ORDER_ENUM_ITEM)
+    CSAND_SCAN_ORDERS_COUNT,
+} CsandScanOrder;
+
+// which way rows of cells are gone over, always left to right leans flows to one side
+static CsandScanOrder scan_order = CSAND_SCAN_ALTERNATING;
+// what the dev menu generates
+static CsandScene menu_scene = CSAND_SCENE_LANDSCAPE;
+static int menu_scene_seed = 1;
+// 0 means one per processor
+static unsigned int scene_threads = 0;
+// the size the world was asked to be, either can be CSAND_WORLD_UNBOUNDED
+static unsigned int world_width = WORLD_WIDTH;
+static unsigned int world_height = WORLD_HEIGHT;
+
+typedef void (*CsandParticleKernel)(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat);
+
 typedef struct CsandMaterialProperties {
     const char *name;
     uint32_t density;
@@ -86,6 +178,9 @@ static CsandMaterialProperties materials[MATERIALS_COUNT] = {
     [MAT_HYDROGEN_LIQUID] = {"hydrogen liquid", 70800,   MAT_KIND_FLUID,  3,            NPROB(0.1),  MAT_HYDROGEN_GAS},
 };
 
+// the update function for each material, picked by its kind
+static CsandParticleKernel particle_kernels[MATERIALS_COUNT] = {0};
+
 static CsandRgba palette[MATERIALS_COUNT] = {
     [MAT_AIR]             = {0x00, 0x00, 0x00, 0x87},
     [MAT_WALL]            = {0xFF, 0x00, 0xFF, 0xFF},
@@ -141,11 +236,18 @@ static void csandMouseScrollCallback(double x, double y) {
 }
 
 static void csandRenderCallback(double time);
-static void csandSimulate(CsandRenderBuffer buf);
-static inline unsigned char *csandGetMat(CsandRenderBuffer buf, unsigned int x, unsigned int y);
-static bool csandInBounds(CsandRenderBuffer buf, int x, int y);
+static void csandSimulate(CsandWorld *world);
+static inline unsigned char *csandGetMat(CsandWorld *world, unsigned int x, unsigned int y);
+static inline void csandSetMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat);
+static void csandAddBodySeed(unsigned int x, unsigned int y);
+static bool csandIsRestingSolid(CsandWorld *world, unsigned int x, unsigned int y);
+static void csandForgetRestingBodies(CsandWorld *world);
+static inline bool csandInBounds(CsandWorld *world, unsigned int x, unsigned int y);
 static inline bool csandMatIsFire(unsigned char mat);
-static void tryIgnite(CsandRenderBuffer buf, unsigned int x, unsigned int y);
+static void tryIgnite(CsandWorld *world, unsigned int x, unsigned int y);
+static void csandUpdateParticleKernels(void);
+static void csandGenerateScene(CsandScene scene, uint32_t seed);
+static void csandSetGpuSimulation(bool enabled);
 
 static void csandDoubleSimulationSpeed(void) {
     if (speed < SPEED_LIMIT) {
@@ -164,9 +266,286 @@ static void csandSimulateSingleFrame(void) {
     pause = true;
 }
 
-int main(void) {
+static void csandMoveCamera(int dx, int dy) {
+    long max_x = world.width - view_size.x;
+    long max_y = world.height - view_size.y;
+    camera.x = csandLClamp((long)camera.x + dx, 0, max_x);
+    camera.y = csandLClamp((long)camera.y + dy, 0, max_y);
+}
+
+#ifndef __wasm__
+static const char usage[] =
+    "usage: csand [options]\n"
+    "  --headless      only simulate, without a window or GL\n"
+    "  --size WxH      size of the world in cells\n"
+    "  --ticks N       ticks to simulate headless, 0 by default\n"
+    "  --threads T     threads that generate scenes, 0 means one per processor\n"
+    "  --seed S        seeds the scene and the simulation, 1 by default\n"
+    "  --load PATH     starts from a snapshot, its size wins over --size\n"
+    "  --save PATH     writes a snapshot once done\n"
+    "  --scene NAME    generates a scene over the whole world\n"
+    "  --stats FORMAT  prints throughput and population once done, as text or json\n"
+    "scenes:";
+
+static void csandPrintUsage(void) {
+    fputs(usage, stderr);
+    for (int i = 0; i < CSAND_SCENES_COUNT; i++) {
+        fprintf(stderr, " %s", csand_scene_names[i]);
+    }
+    fputc('\n', stderr);
+}
+
+// a whole number up to max, nothing else
+static bool csandParseUl(const char *text, unsigned long max, unsigned long *value) {
+    char *end;
+    *value = strtoul(text, &end, 10);
+    return end != text && *end == '\0' && *value <= max && text[0] != '-';
+}
+
+static bool csandParseSize(const char *text, CsandOptions *options) {
+    char *end;
+    unsigned long width = strtoul(text, &end, 10);
+    if (end == text || *end != 'x' || text[0] == '-') {
+        return false;
+    }
+
+    unsigned long height;
+    if (!csandParseUl(end + 1, CSAND_WORLD_MAX_SIZE - 1, &height)) {
+        return false;
+    }
+
+    options->width = width;
+    options->height = height;
+    return width != 0 && width < CSAND_WORLD_MAX_SIZE && height != 0;
+}
+
+static bool csandParseOptions(int argc, char **argv, CsandOptions *options) {
+    bool ticks_given = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        if (strcmp(option, "--headless") == 0) {
+            options->headless = true;
+            continue;
+        }
+
+        if (strcmp(option, "--help") == 0 || strcmp(option, "-h") == 0) {
+            csandPrintUsage();
+            return false;
+        }
+
+        // everything else takes a value
+        if (i + 1 == argc) {
+            fprintf(stderr, "csand: %s needs a value\n", option);
+            return false;
+        }
+        const char *value = argv[++i];
+        unsigned long number;
+        bool ok = true;
+
+        if (strcmp(option, "--size") == 0) {
+            ok = csandParseSize(value, options);
+        } else if (strcmp(option, "--ticks") == 0) {
+            ok = csandParseUl(value, ULONG_MAX, &options->ticks);
+            ticks_given = true;
+        } else if (strcmp(option, "--threads") == 0) {
+            ok = csandParseUl(value, UINT_MAX, &number);
+            scene_threads = number;
+        } else if (strcmp(option, "--seed") == 0) {
+            ok = csandParseUl(value, UINT32_MAX, &number);
+            options->seed = number;
+        } else if (strcmp(option, "--load") == 0) {
+            options->load_path = value;
+        } else if (strcmp(option, "--save") == 0) {
+            options->save_path = value;
+        } else if (strcmp(option, "--scene") == 0) {
+            ok = csandSceneFromName(value, &options->scene);
+            options->generate_scene = true;
+        } else if (strcmp(option, "--stats") == 0) {
+            ok = strcmp(value, "text") == 0 || strcmp(value, "json") == 0;
+            options->stats = value[0] == 't' ? CSAND_STATS_TEXT : CSAND_STATS_JSON;
+        } else {
+            fprintf(stderr, "csand: unknown option %s\n", option);
+            csandPrintUsage();
+            return false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "csand: bad value for %s: %s\n", option, value);
+            return false;
+        }
+    }
+
+    if (!options->headless && (ticks_given || options->stats != CSAND_STATS_NONE)) {
+        fprintf(stderr, "csand: --ticks and --stats only go with --headless\n");
+        return false;
+    }
+
+    return true;
+}
+
+static double csandNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Cells of every material in the chunks the world has, plus the chunks it
+ * doesn't as air if it's bounded. Cells past the edge of the world don't
+ * count. */
+static void csandCountPopulation(unsigned long long population[MATERIALS_COUNT]) {
+    memset(population, 0, MATERIALS_COUNT * sizeof(population[0]));
+
+    unsigned long long counted = 0;
+    unsigned char cells[CSAND_CHUNK_AREA];
+    for (size_t i = 0; i < world.chunk_slots_count; i++) {
+        const CsandChunk *chunk = world.chunk_slots[i];
+        if (chunk == NULL) {
+            continue;
+        }
+
+        csandWorldReadChunk(&world, chunk, cells);
+        unsigned int start_x = chunk->x << CSAND_CHUNK_SIZE_LOG2;
+        unsigned int start_y = chunk->y << CSAND_CHUNK_SIZE_LOG2;
+        unsigned int width = csandUiMin(world.width - start_x, CSAND_CHUNK_SIZE);
+        unsigned int height = csandUiMin(world.height - start_y, CSAND_CHUNK_SIZE);
+        for (unsigned int y = 0; y < height; y++) {
+            for (unsigned int x = 0; x < width; x++) {
+                population[cells[(y << CSAND_CHUNK_SIZE_LOG2) | x] & ~MAT_UPDATED_BIT]++;
+            }
+        }
+        counted += (unsigned long long)width * height;
+    }
+
+    if (world_width != CSAND_WORLD_UNBOUNDED && world_height != CSAND_WORLD_UNBOUNDED) {
+        population[MAT_AIR] += (unsigned long long)world.width * world.height - counted;
+    }
+}
+
+static void csandPrintStats(CsandStatsFormat format, unsigned long ticks, double seconds) {
+    // unbounded axes only simulate around the view
+    double width = world_width == CSAND_WORLD_UNBOUNDED ? view_size.x : world.width;
+    double height = world_height == CSAND_WORLD_UNBOUNDED ? view_size.y : world.height;
+    double ticks_per_second = seconds > 0 ? ticks / seconds : 0;
+    double cells_per_second = ticks_per_second * width * height;
+
+    static unsigned long long population[MATERIALS_COUNT];
+    csandCountPopulation(population);
+
+    if (format == CSAND_STATS_JSON) {
+        printf("{\"width\": %.0f, \"height\": %.0f, \"ticks\": %lu, \"seconds\": %.6f, ", width, height, ticks, seconds);
+        printf("\"ticks_per_second\": %.3f, \"cells_per_second\": %.0f, ", ticks_per_second, cells_per_second);
+        printf("\"chunks\": %lu, \"memory_bytes\": %lu, \"asleep\": %s, \"population\": {",
+            (unsigned long)world.chunks_count, (unsigned long)csandWorldMemoryUsage(&world), csandWorldIsAsleep(&world) ? "true" : "false");
+    } else {
+        printf("%.0fx%.0f cells, %lu ticks in %.3f s\n", width, height, ticks, seconds);
+        printf("%.1f ticks/s, %.0f cells/s\n", ticks_per_second, cells_per_second);
+        printf("%lu chunks, %lu bytes, %s\n",
+            (unsigned long)world.chunks_count, (unsigned long)csandWorldMemoryUsage(&world), csandWorldIsAsleep(&world) ? "asleep" : "awake");
+    }
+
+    bool first = true;
+    for (unsigned int i = 0; i < MATERIALS_COUNT; i++) {
+        if (population[i] == 0) {
+            continue;
+        }
+
+        const char *name = materials[i].name != NULL ? materials[i].name : "unnamed";
+        if (format == CSAND_STATS_JSON) {
+            printf("%s\"%s\": %llu", first ? "" : ", ", name, population[i]);
+        } else {
+            printf("%s: %llu\n", name, population[i]);
+        }
+        first = false;
+    }
+
+    if (format == CSAND_STATS_JSON) {
+        printf("}}\n");
+    }
+}
+
+static int csandRunHeadless(const CsandOptions *options) {
+    // what's active is only set by the renderer otherwise
+    csandWorldSetFocus(&world, camera.x, camera.y, view_size.x, view_size.y);
+
+    double start = csandNow();
+    for (unsigned long i = 0; i < options->ticks; i++) {
+        csandSimulate(&world);
+    }
+    double seconds = csandNow() - start;
+
+    int status = 0;
+    if (options->save_path != NULL && !csandWorldSave(&world, options->save_path)) {
+        fprintf(stderr, "csand: failed to save %s\n", options->save_path);
+        status = 1;
+    }
+
+    if (options->stats != CSAND_STATS_NONE) {
+        csandPrintStats(options->stats, options->ticks, seconds);
+    }
+
+    return status;
+}
+#endif
+
+static int csandRun(const CsandOptions *options) {
+    world_width = options->width;
+    world_height = options->height;
+    if (options->load_path != NULL && !csandWorldSnapshotSize(options->load_path, &world_width, &world_height)) {
+        csandPlatformPrintErr("failed to read the snapshot\n");
+        return 1;
+    }
+
+    if (!csandWorldInit(&world, world_width, world_height, WORLD_FORMAT)) {
+        csandPlatformPrintErr("failed to allocate the world\n");
+        return 1;
+    }
+
+#ifdef WORLD_MEMORY_LIMIT
+    csandWorldSetMemoryLimit(&world, WORLD_MEMORY_LIMIT);
+#endif
+
+#ifdef WORLD_HUGE_PAGES
+    if (!csandWorldEnableHugePages(&world)) {
+        csandPlatformPrintErr("huge pages aren't available, using normal ones\n");
+    }
+#endif
+
+#ifdef WORLD_PAGE_FILE
+    if (!csandWorldEnablePaging(&world, WORLD_PAGE_FILE)) {
+        csandPlatformPrintErr("failed to open the page file, keeping everything in memory\n");
+    }
+#endif
+
+    if (options->load_path != NULL && !csandWorldLoad(&world, options->load_path)) {
+        csandPlatformPrintErr("failed to load the snapshot\n");
+        return 1;
+    }
+
+    view_size.x = world_width == CSAND_WORLD_UNBOUNDED ? WIDTH : csandUiMin(world.width, USHRT_MAX);
+    view_size.y = world_height == CSAND_WORLD_UNBOUNDED ? HEIGHT : csandUiMin(world.height, USHRT_MAX);
+    // unbounded worlds start out in the middle, so there's room in every direction
+    camera.x = world_width == CSAND_WORLD_UNBOUNDED ? world.width / 2 : 0;
+    camera.y = world_height == CSAND_WORLD_UNBOUNDED ? world.height / 2 : 0;
+    csandMoveCamera(0, 0);
+
+    csandSeedRand(options->seed);
+    menu_scene_seed = options->seed < INT_MAX ? options->seed : INT_MAX;
+    if (options->generate_scene) {
+        menu_scene = options->scene;
+        csandGenerateScene(options->scene, options->seed);
+    }
+
+    csandUpdateParticleKernels();
+
+#ifndef __wasm__
+    if (options->headless) {
+        return csandRunHeadless(options);
+    }
+#endif
+
     csandPlatformInit();
-    csandRendererInit((CsandVec2Us){WIDTH, HEIGHT}, csandPlatformGetFramebufferSize(), palette, MATERIALS_COUNT);
+    csandRendererInit(view_size, csandPlatformGetFramebufferSize(), palette, MATERIALS_COUNT);
     csandRendererSetGlow(true);
     csandPlatformSetKeyCallback(csandKeyCallback);
     csandPlatformSetCharCallback(csandCharCallback);
@@ -177,7 +556,41 @@ int main(void) {
     csandPlatformSetFramebufferSizeCallback(csandRendererUpdateViewport);
     nk_input_begin(csandRendererNuklearContext());
     csandPlatformRun();
+
+#ifndef __wasm__
+    // the window was closed, the gpu simulation still has the latest cells of the view
+    if (options->save_path != NULL) {
+        csandSetGpuSimulation(false);
+        if (!csandWorldSave(&world, options->save_path)) {
+            fprintf(stderr, "csand: failed to save %s\n", options->save_path);
+            return 1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static const CsandOptions default_options = {
+    .width = WORLD_WIDTH,
+    .height = WORLD_HEIGHT,
+    .seed = 1,
+};
+
+#ifdef __wasm__
+int main(void) {
+    return csandRun(&default_options);
+}
+#else
+int main(int argc, char **argv) {
+    CsandOptions options = default_options;
+    if (!csandParseOptions(argc, argv, &options)) {
+        return 2;
+    }
+
+    return csandRun(&options);
 }
+#endif
 
 static void csandSendKeyStateToNuklear(CsandKey key, CsandAction action, CsandModSet mods) {
     struct nk_context *nk_ctx = csandRendererNuklearContext();
@@ -331,6 +744,18 @@ static bool csandKeyCallback(CsandKey key, CsandAction action, CsandModSet mods)
         case CSAND_KEY_TAB:
             developer_menu_enabled = !developer_menu_enabled;
             return true;
+        case CSAND_KEY_LEFT:
+            csandMoveCamera(-CAMERA_STEP, 0);
+            return true;
+        case CSAND_KEY_RIGHT:
+            csandMoveCamera(CAMERA_STEP, 0);
+            return true;
+        case CSAND_KEY_DOWN:
+            csandMoveCamera(0, -CAMERA_STEP);
+            return true;
+        case CSAND_KEY_UP:
+            csandMoveCamera(0, CAMERA_STEP);
+            return true;
         default:
             break;
     }
@@ -342,6 +767,74 @@ static void csandCharCallback(uint32_t codepoint) {
     nk_input_unicode(csandRendererNuklearContext(), codepoint);
 }
 
+/* Builds what sim.frag needs from the material properties. Densities become
+ * ranks to fit in a byte. Fire spreads like in tryIgnite, except that the
+ * shader only looks for air right next to the cell. */
+static void csandUpdateGpuSimMaterials(void) {
+    // equal densities count once, so materials that can't displace each other keep the same rank
+    bool first_of_density[MATERIALS_COUNT];
+    for (unsigned int i = 0; i < MATERIALS_COUNT; i++) {
+        first_of_density[i] = true;
+        for (unsigned int j = 0; j < i && first_of_density[i]; j++) {
+            first_of_density[i] = materials[j].density != materials[i].density;
+        }
+    }
+
+    CsandGpuSimMaterial gpu_materials[MATERIALS_COUNT];
+    for (unsigned int i = 0; i < MATERIALS_COUNT; i++) {
+        const CsandMaterialProperties *props = &materials[i];
+
+        unsigned int density_rank = 0;
+        for (unsigned int j = 0; j < MATERIALS_COUNT; j++) {
+            density_rank += first_of_density[j] && materials[j].density < props->density;
+        }
+
+        bool fluid = props->kind == MAT_KIND_FLUID;
+        gpu_materials[i] = (CsandGpuSimMaterial){
+            .kind = props->kind,
+            .density_rank = density_rank,
+            .fire = csandMatIsFire(i),
+            .decay_mat = props->decay_mat,
+            .decay_prob = props->decay_prob,
+            .ignition_prob = props->ignition_prob,
+            .burn_mats = {MAT_FIRE_GAS, fluid ? MAT_FIRE_LIQUID : MAT_FIRE_POWDER},
+        };
+    }
+
+    csandRendererGpuSimSetMaterials(gpu_materials, MATERIALS_COUNT);
+}
+
+static void csandSetGpuSimulation(bool enabled) {
+    if (enabled && !gpu_simulation) {
+        csandUpdateGpuSimMaterials();
+        gpu_simulation = csandRendererGpuSimStart(&world, camera);
+    } else if (!enabled && gpu_simulation) {
+        csandRendererGpuSimStop(&world);
+        gpu_simulation = false;
+        // the cells it wrote back never went past csandSetMat
+        csandForgetRestingBodies(&world);
+    }
+}
+
+/* Fills the whole world, or what's in view along unbounded axes. The gpu
+ * simulation holds its own copy of the view, so it's restarted from the new
+ * cells. */
+static void csandGenerateScene(CsandScene scene, uint32_t seed) {
+    bool restart_gpu_simulation = gpu_simulation;
+    csandSetGpuSimulation(false);
+
+    bool unbounded_x = world_width == CSAND_WORLD_UNBOUNDED;
+    bool unbounded_y = world_height == CSAND_WORLD_UNBOUNDED;
+    csandSceneGenerate(&world, scene, seed,
+        unbounded_x ? camera.x : 0, unbounded_y ? camera.y : 0,
+        unbounded_x ? view_size.x : world.width, unbounded_y ? view_size.y : world.height,
+        scene_threads);
+    // bodies reaching out of the new cells may have lost their support
+    csandForgetRestingBodies(&world);
+
+    csandSetGpuSimulation(restart_gpu_simulation);
+}
+
 static void csandDrawDeveloperMenu(void) {
     struct nk_context *nk_ctx = csandRendererNuklearContext();
 
@@ -376,9 +869,11 @@ static void csandDrawDeveloperMenu(void) {
         nk_layout_row_end(nk_ctx);
 
         bool palette_changed = false;
+        bool materials_changed = false;
 
         for (unsigned int i = 0; i < MATERIALS_COUNT; i++) {
             CsandMaterialProperties *props = &materials[i];
+            CsandMaterialProperties old_props = *props;
 
             nk_layout_row_begin(nk_ctx, NK_STATIC, row_height, cols);
 
@@ -411,11 +906,7 @@ static void csandDrawDeveloperMenu(void) {
             props->density = nk_propertyi(nk_ctx, "##density", 0, props->density, INT_MAX, 25, 500);
 
             nk_layout_row_push(nk_ctx, other_width);
-            static const char *kinds[] = {
-                [MAT_KIND_SOLID] = "solid",
-                [MAT_KIND_POWDER] = "powder",
-                [MAT_KIND_FLUID] = "fluid"
-            };
+            static const char *kinds[] = {CSAND_X_MATERIAL_KINDS(CSAND_GEN_MATERIAL_KIND_LABEL)};
 
             props->kind = nk_combo(nk_ctx, kinds, sizeof(kinds) / sizeof(kinds[0]), props->kind, row_height, nk_vec2(other_width, row_height*(MAT_KINDS_COUNT + 1)));
             props->decay_prob = nk_propertyi(nk_ctx, "##decay_prob", 0, props->decay_prob, UINT16_MAX, 1, 1);
@@ -423,11 +914,69 @@ static void csandDrawDeveloperMenu(void) {
             props->decay_mat = nk_propertyi(nk_ctx, "##decay_mat", 0, props->decay_mat, MATERIALS_COUNT - 1, 1, 0.5);
 
             nk_layout_row_end(nk_ctx);
+
+            materials_changed = materials_changed ||
+                props->density != old_props.density ||
+                props->kind != old_props.kind ||
+                props->decay_prob != old_props.decay_prob ||
+                props->ignition_prob != old_props.ignition_prob ||
+                props->decay_mat != old_props.decay_mat;
         }
 
         if (palette_changed) {
             csandRendererSetPalette(palette, MATERIALS_COUNT);
         }
+
+        nk_layout_row_dynamic(nk_ctx, row_height, 1);
+        nk_labelf(nk_ctx, align, "WORLD MEMORY: %lu KiB", (unsigned long)(csandWorldMemoryUsage(&world) / 1024));
+        if (world.budget.limit != 0) {
+            nk_labelf(nk_ctx, align, "WORLD MEMORY LIMIT: %lu KiB", (unsigned long)(world.budget.limit / 1024));
+        }
+        nk_labelf(nk_ctx, align, "TICK SCRATCH PEAK: %lu KiB", (unsigned long)(world.tick_arena.peak / 1024));
+        nk_labelf(nk_ctx, align, "CHUNKS: %lu", (unsigned long)world.chunks_count);
+        nk_labelf(nk_ctx, align, "JS GLUE ALLOCATIONS: %lu B/FRAME", (unsigned long)csandPlatformGetFrameGlueAllocations());
+
+        nk_bool block_updates_checked = block_updates;
+        if (nk_checkbox_label(nk_ctx, "BLOCK UPDATES", &block_updates_checked)) {
+            block_updates = block_updates_checked;
+            // cells settled by one rule may not be settled by the other
+            csandWorldWakeAll(&world);
+        }
+
+        static const char *scan_orders[] = {CSAND_X_SCAN_ORDERS(CSAND_GEN_SCAN_ORDER_LABEL)};
+        nk_layout_row_begin(nk_ctx, NK_STATIC, row_height, 2);
+        nk_layout_row_push(nk_ctx, name_width);
+        nk_label(nk_ctx, "SCAN ORDER", align);
+        nk_layout_row_push(nk_ctx, name_width);
+        scan_order = nk_combo(nk_ctx, scan_orders, CSAND_SCAN_ORDERS_COUNT, scan_order, row_height, nk_vec2(name_width, row_height * (CSAND_SCAN_ORDERS_COUNT + 1)));
+        nk_layout_row_end(nk_ctx);
+        nk_layout_row_dynamic(nk_ctx, row_height, 1);
+
+        nk_layout_row_begin(nk_ctx, NK_STATIC, row_height, 4);
+        nk_layout_row_push(nk_ctx, name_width);
+        nk_label(nk_ctx, "SCENE", align);
+        nk_layout_row_push(nk_ctx, name_width);
+        menu_scene = nk_combo(nk_ctx, csand_scene_names, CSAND_SCENES_COUNT, menu_scene, row_height, nk_vec2(name_width, row_height * (CSAND_SCENES_COUNT + 1)));
+        menu_scene_seed = nk_propertyi(nk_ctx, "#SEED", 0, menu_scene_seed, INT_MAX, 1, 1);
+        if (nk_button_label(nk_ctx, "GENERATE")) {
+            csandGenerateScene(menu_scene, menu_scene_seed);
+        }
+        nk_layout_row_end(nk_ctx);
+        nk_layout_row_dynamic(nk_ctx, row_height, 1);
+
+        nk_bool gpu_simulation_checked = gpu_simulation;
+        if (nk_checkbox_label(nk_ctx, "GPU SIMULATION", &gpu_simulation_checked)) {
+            csandSetGpuSimulation(gpu_simulation_checked);
+        }
+
+        // settled cells were judged by the old properties
+        if (materials_changed) {
+            csandUpdateParticleKernels();
+            csandWorldWakeAll(&world);
+            if (gpu_simulation) {
+                csandUpdateGpuSimMaterials();
+            }
+        }
     }
     nk_end(nk_ctx);
 }
@@ -492,9 +1041,20 @@ static void csandDrawButtons(void) {
 }
 
 static void csandRenderCallback(double time) {
+#ifdef CSAND_THREADS
+    // nothing gets drawn, so the last frame stays on screen and the input piles up for the next one
+    if (!csandMutexTryLock(&world_mutex)) {
+        __atomic_store_n(&render_waiting, 1, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+
     struct nk_context *nk_ctx = csandRendererNuklearContext();
     nk_input_end(nk_ctx);
 
+    // the camera may have moved since the last frame
+    csandWorldSetFocus(&world, camera.x, camera.y, view_size.x, view_size.y);
+
     csandDrawButtons();
 
     if (developer_menu_enabled) {
@@ -504,104 +1064,1317 @@ static void csandRenderCallback(double time) {
     any_nuklear_item_active = nk_item_is_any_active(nk_ctx);
 
     bool draw = !any_nuklear_item_active && csandPlatformIsMouseButtonPressed(CSAND_MOUSE_BUTTON_LEFT);
-    CsandVec2Us cur_pos = csandRendererScreenSpaceToWorldSpace(csandPlatformGetCursorPos());
+    CsandVec2Us cur_view_pos = csandRendererScreenSpaceToWorldSpace(csandPlatformGetCursorPos());
+    CsandVec2Ui cur_pos = csandVec2UiAdd(camera, CSAND_VEC2_CONVERT(CsandVec2Ui, cur_view_pos));
+
+#ifdef CSAND_THREADS
+    // a simulation that can't keep up drops ticks instead of queueing them
+    bool can_tick = __atomic_load_n(&pending_ticks, __ATOMIC_RELAXED) == 0;
+#else
+    bool can_tick = true;
+#endif
+
+    bool tick = time >= next_tick_time && (!pause || input_next_frame);
 
-    if (time >= next_tick_time && (!pause || input_next_frame)) {
+    // gl calls have to come from this thread, so the gpu simulation never goes to the simulation thread
+    if (gpu_simulation && tick) {
+        input_next_frame = false;
+        for (unsigned long i = 0; i < speed; i++) {
+            csandRendererGpuSimStep(csandRand());
+            if (draw) {
+                csandRendererGpuSimSetCell(cur_pos.x, cur_pos.y, draw_mat);
+            }
+        }
+        next_tick_time = time + TARGET_TICK_DELAY;
+    } else if (gpu_simulation) {
+        if (draw) {
+            csandRendererGpuSimSetCell(cur_pos.x, cur_pos.y, draw_mat);
+        }
+    } else if (can_tick && tick) {
         input_next_frame = false;
+#ifdef CSAND_THREADS
+        pending_draw = draw;
+        pending_draw_pos = cur_pos;
+        pending_draw_mat = draw_mat;
+        __atomic_store_n(&pending_ticks, speed, __ATOMIC_RELAXED);
+#else
         for (unsigned long i = 0; i < speed; i++) {
-            csandSimulate(render_buf);
+            csandSimulate(&world);
             if (draw) {
-                *csandGetMat(render_buf, cur_pos.x, cur_pos.y) = draw_mat;
+                csandSetMat(&world, cur_pos.x, cur_pos.y, draw_mat);
             }
         }
+#endif
         next_tick_time = time + TARGET_TICK_DELAY;
     } else if (draw) {
-        *csandGetMat(render_buf, cur_pos.x, cur_pos.y) = draw_mat;
+        csandSetMat(&world, cur_pos.x, cur_pos.y, draw_mat);
     }
 
-    csandRendererRender(data, WIDTH, HEIGHT);
+    csandRendererRender(&world, camera);
     nk_clear(nk_ctx);
 
     nk_input_begin(nk_ctx);
+
+    // with nothing left to simulate or draw, the next frame would look just like this one
+    // there's no telling when the gpu simulation settles without reading it back
+    bool world_idle = (pause && !input_next_frame) || (!gpu_simulation && csandWorldIsAsleep(&world));
+#ifdef CSAND_THREADS
+    world_idle = world_idle && __atomic_load_n(&pending_ticks, __ATOMIC_RELAXED) == 0;
+#endif
+    csandPlatformSetIdle(world_idle && !draw && !any_nuklear_item_active && !csandRendererUiChanged());
+
+#ifdef CSAND_THREADS
+    __atomic_store_n(&render_waiting, 0, __ATOMIC_RELAXED);
+    csandMutexUnlock(&world_mutex);
+    csandThreadNotify(&render_waiting);
+    csandThreadNotify(&pending_ticks);
+#endif
 }
 
-static void csandSimulate(CsandRenderBuffer buf) {
-    for (unsigned int y = 0; y < buf.height; y++) {
-        for (unsigned int x = 0; x < buf.width; x++) {
-            unsigned char mat = *csandGetMat(buf, x, y);
+#ifdef CSAND_THREADS
+#define SIMULATION_THREAD_YIELD_TIMEOUT_NS 100000000
 
-            if (mat & MAT_UPDATED_BIT) {
-                continue;
-            }
-            CsandMaterialProperties mat_props = materials[mat];
+/* Entry point of the Web Worker running the simulation, never returns. The
+ * lock is taken per tick, and a frame that wants the world gets it before
+ * the next tick starts, or after a timeout in case the page stopped
+ * rendering. */
+void csandSimulationThread(void) {
+    for (;;) {
+        csandThreadWait(&pending_ticks, 0, -1);
 
-            if (csandChance(mat_props.decay_prob)) {
-                *csandGetMat(buf, x, y) = mat_props.decay_mat | MAT_UPDATED_BIT;
-                continue;
+        if (__atomic_load_n(&render_waiting, __ATOMIC_RELAXED)) {
+            csandThreadWait(&render_waiting, 1, SIMULATION_THREAD_YIELD_TIMEOUT_NS);
+        }
+
+        csandMutexLock(&world_mutex);
+        if (pending_ticks > 0) {
+            csandSimulate(&world);
+            if (pending_draw) {
+                csandSetMat(&world, pending_draw_pos.x, pending_draw_pos.y, pending_draw_mat);
             }
+            __atomic_store_n(&pending_ticks, pending_ticks - 1, __ATOMIC_RELAXED);
+        }
+        csandMutexUnlock(&world_mutex);
+    }
+}
+#endif
 
-            int dx = csandRand() % 3 - 1;
-            int dy = mat_props.kind == MAT_KIND_POWDER ? -1 : -(csandRand() & 1);
+// how far along a row a liquid looks for somewhere lower to go, cells within a chunk of awake ones are always loaded
+#define CSAND_LIQUID_REACH CSAND_CHUNK_SIZE
 
-            if (!csandInBounds(buf, x + dx, y + dy)) {
-                continue;
+static inline bool csandIsSolidMat(unsigned char mat) {
+    return materials[mat & (~MAT_UPDATED_BIT)].kind == MAT_KIND_SOLID;
+}
+
+// powders hold up solids, and so do fluids at least as dense, so wood floats and walls sink
+static inline bool csandCanRestOn(unsigned char below, unsigned char mat) {
+    return materials[below].kind == MAT_KIND_POWDER || materials[below].density >= materials[mat].density;
+}
+
+// fluids heavier than air, which pool up instead of rising
+static inline bool csandIsLiquid(unsigned char mat) {
+    return materials[mat].kind == MAT_KIND_FLUID && materials[mat].density > materials[MAT_AIR].density;
+}
+
+// true if nothing below the cell is lighter than the given density, the world edge included
+static bool csandIsSupported(CsandWorld *world, unsigned int x, unsigned int y, uint32_t density) {
+    if (!csandInBounds(world, x, y - 1)) {
+        return true;
+    }
+
+    CsandMaterialProperties below = materials[*csandGetMat(world, x, y - 1) & (~MAT_UPDATED_BIT)];
+    return below.kind == MAT_KIND_SOLID || below.density >= density;
+}
+
+/* Walks along the row from x in the direction of dx, over cells a liquid of
+ * the given density would flow into, until one of them has something lighter
+ * below it. Returns how many cells away that is, 0 if something the liquid
+ * can't pass comes first, or -1 if neither happens within CSAND_LIQUID_REACH. */
+static int csandFindLiquidDrop(CsandWorld *world, unsigned int x, unsigned int y, int dx, uint32_t density) {
+    for (int distance = 1; distance <= CSAND_LIQUID_REACH; distance++) {
+        unsigned int nx = x + dx * distance;
+        if (!csandInBounds(world, nx, y)) {
+            return 0;
+        }
+
+        unsigned char mat = *csandGetMat(world, nx, y) & (~MAT_UPDATED_BIT);
+        CsandMaterialProperties props = materials[mat];
+        if (props.kind == MAT_KIND_SOLID || props.density >= density || csandMatIsFire(mat)) {
+            return 0;
+        }
+
+        if (!csandIsSupported(world, nx, y, density)) {
+            return distance;
+        }
+    }
+
+    return -1;
+}
+
+/* A liquid lying on something with nowhere lower to flow to within reach
+ * along its row is as level as it gets, even with lighter cells beside it.
+ * Like everything settled it only looks again once a neighbor changes, so a
+ * hole opening further along the row waits for the liquid next to it. */
+static bool csandIsLevelLiquid(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat) {
+    uint32_t density = materials[mat].density;
+    return csandIsLiquid(mat) &&
+        csandIsSupported(world, x, y, density) &&
+        csandFindLiquidDrop(world, x, y, -1, density) <= 0 &&
+        csandFindLiquidDrop(world, x, y, 1, density) <= 0;
+}
+
+/* A cell just got lighter, which may have given liquids resting further
+ * along its row, or the row above, somewhere lower to flow to. Wakes the
+ * first liquid each way, anything past that one is its business. Liquids
+ * past a cell with gas under it already had a drop there, so the walk stops
+ * at one, which keeps moves through open air down to a few reads. */
+static void csandWakeLiquidsAround(CsandWorld *world, unsigned int x, unsigned int y) {
+    for (unsigned int row = y; row <= y + 1; row++) {
+        for (int dx = -1; dx <= 1; dx += 2) {
+            for (int distance = 1; distance <= CSAND_LIQUID_REACH; distance++) {
+                unsigned int nx = x + dx * distance;
+                if (!csandInBounds(world, nx, row)) {
+                    break;
+                }
+
+                unsigned char mat = *csandGetMat(world, nx, row) & (~MAT_UPDATED_BIT);
+                if (csandIsLiquid(mat)) {
+                    csandWorldWake(world, nx, row);
+                    break;
+                }
+
+                if (materials[mat].kind != MAT_KIND_FLUID) {
+                    break;
+                }
+
+                unsigned char below = csandInBounds(world, nx, row - 1) ? *csandGetMat(world, nx, row - 1) & (~MAT_UPDATED_BIT) : MAT_WALL;
+                if (materials[below].kind == MAT_KIND_FLUID && !csandIsLiquid(below)) {
+                    break;
+                }
             }
+        }
+    }
+}
+
+/* Touching fire can turn either cell into something of another kind, so
+ * this part can't be specialized and finishes the update for whatever the
+ * cells are afterwards. */
+static void csandSimulateFireContact(CsandWorld *world, unsigned int x, unsigned int y, unsigned int sx, unsigned int sy, unsigned char mat, unsigned char swap_mat) {
+    if (csandMatIsFire(mat)) {
+        tryIgnite(world, sx, sy);
+        swap_mat = *csandGetMat(world, sx, sy) & (~MAT_UPDATED_BIT);
+    } else {
+        tryIgnite(world, x, y);
+        mat = *csandGetMat(world, x, y) & (~MAT_UPDATED_BIT);
+    }
+
+    CsandMaterialProperties mat_props = materials[mat];
+    CsandMaterialProperties swap_mat_props = materials[swap_mat];
+    if (mat_props.kind != MAT_KIND_SOLID && swap_mat_props.kind != MAT_KIND_SOLID && swap_mat_props.density < mat_props.density) {
+        csandSetMat(world, x, y, swap_mat);
+        csandSetMat(world, sx, sy, mat | MAT_UPDATED_BIT);
+    }
+}
+
+/* Moves a liquid resting on something straight into the nearest drop along
+ * its row, instead of letting it random walk there a step at a time. Looks
+ * the way of dx first, so neither side is favored. */
+static bool csandFlowLiquid(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat, int dx) {
+    uint32_t density = materials[mat].density;
+    if (!csandIsSupported(world, x, y, density)) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++, dx = -dx) {
+        int distance = csandFindLiquidDrop(world, x, y, dx, density);
+        if (distance <= 0) {
+            continue;
+        }
+
+        unsigned int tx = x + dx * distance;
+        unsigned char target = *csandGetMat(world, tx, y - 1);
+        if (target & MAT_UPDATED_BIT) {
+            continue;
+        }
+
+        // fire meeting something rolls for ignition the same as a step would
+        if (csandMatIsFire(mat) || csandMatIsFire(target)) {
+            csandSimulateFireContact(world, x, y, tx, y - 1, mat, target);
+            return true;
+        }
+
+        csandSetMat(world, x, y, target);
+        csandSetMat(world, tx, y - 1, mat | MAT_UPDATED_BIT);
+        csandWakeLiquidsAround(world, x, y);
+        return true;
+    }
+
+    return false;
+}
 
-            unsigned int sx = x + dx;
-            unsigned int sy = y + dy;
-            unsigned char swap_mat = *csandGetMat(buf, sx, sy);
-            if (swap_mat & MAT_UPDATED_BIT) {
+/* One update function per kind, so the kind checks fold away: powders only
+ * look straight or diagonally down, solids never move and only get this far
+ * to catch fire. Rolls the same dice in the same order as a single function
+ * would, so a seed plays out the same either way. */
+#define CSAND_GEN_PARTICLE_KERNEL(id, name, label) \
+    static void csandSimulate##name(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat) { \
+        const CsandMaterialKind kind = MAT_KIND_##id; \
+        CsandMaterialProperties mat_props = materials[mat]; \
+        \
+        if (csandChance(mat_props.decay_prob)) { \
+            csandSetMat(world, x, y, mat_props.decay_mat | MAT_UPDATED_BIT); \
+            return; \
+        } \
+        \
+        /* writes that take away what held a body up seed it themselves, this \
+         * catches the solids nothing is known about yet */ \
+        if (kind == MAT_KIND_SOLID && csandInBounds(world, x, y - 1) && !csandIsRestingSolid(world, x, y)) { \
+            unsigned char below = *csandGetMat(world, x, y - 1); \
+            if (!csandIsSolidMat(below) && !csandCanRestOn(below & (~MAT_UPDATED_BIT), mat)) { \
+                csandAddBodySeed(x, y); \
+            } \
+        } \
+        \
+        int dx = csandRand() % 3 - 1; \
+        int dy = kind == MAT_KIND_POWDER ? -1 : -(int)(csandRand() & 1); \
+        \
+        if (kind == MAT_KIND_FLUID && csandIsLiquid(mat) && csandFlowLiquid(world, x, y, mat, dx != 0 ? dx : 1 + 2 * dy)) { \
+            return; \
+        } \
+        \
+        if (!csandInBounds(world, x + dx, y + dy)) { \
+            return; \
+        } \
+        \
+        unsigned int sx = x + dx; \
+        unsigned int sy = y + dy; \
+        unsigned char swap_mat = *csandGetMat(world, sx, sy); \
+        if (swap_mat & MAT_UPDATED_BIT) { \
+            return; \
+        } \
+        \
+        if (csandMatIsFire(mat) || csandMatIsFire(swap_mat)) { \
+            csandSimulateFireContact(world, x, y, sx, sy, mat, swap_mat); \
+            return; \
+        } \
+        \
+        if (kind == MAT_KIND_SOLID) { \
+            return; \
+        } \
+        \
+        CsandMaterialProperties swap_mat_props = materials[swap_mat]; \
+        if (swap_mat_props.kind == MAT_KIND_SOLID || swap_mat_props.density >= mat_props.density) { \
+            return; \
+        } \
+        \
+        csandSetMat(world, x, y, swap_mat); \
+        csandSetMat(world, sx, sy, mat | MAT_UPDATED_BIT); \
+        csandWakeLiquidsAround(world, x, y); \
+    }
+
+CSAND_X_MATERIAL_KINDS(CSAND_GEN_PARTICLE_KERNEL)
+
+#define CSAND_GEN_PARTICLE_KERNEL_ITEM(id, name, label) [MAT_KIND_##id] = csandSimulate##name,
+
+static const CsandParticleKernel kind_kernels[MAT_KINDS_COUNT] = {CSAND_X_MATERIAL_KINDS(CSAND_GEN_PARTICLE_KERNEL_ITEM)};
+
+// has to be called again whenever the kind of a material changes
+static void csandUpdateParticleKernels(void) {
+    for (unsigned int i = 0; i < MATERIALS_COUNT; i++) {
+        particle_kernels[i] = kind_kernels[materials[i].kind];
+    }
+}
+
+/* Returns true if no roll of the particle kernels or csandSimulateBlock can
+ * change anything until one of the neighbors does. Must be kept in sync with
+ * both. Blocks can catch fire from above too, so fire anywhere around counts
+ * for anything that burns. Blocks spread liquids sideways into anything
+ * lighter however level they are, so only the particle kernels let level
+ * liquids settle, which also keeps blocks from looking along rows past the
+ * chunks loaded around them. */
+static bool csandCanSettle(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat, bool blocks) {
+    CsandMaterialProperties mat_props = materials[mat];
+
+    if (mat_props.decay_prob != 0 || csandMatIsFire(mat)) {
+        return false;
+    }
+
+    int max_dy = mat_props.kind == MAT_KIND_POWDER ? -1 : 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if ((dx == 0 && dy == 0) || !csandInBounds(world, x + dx, y + dy)) {
                 continue;
             }
 
+            unsigned char swap_mat = *csandGetMat(world, x + dx, y + dy) & (~MAT_UPDATED_BIT);
             CsandMaterialProperties swap_mat_props = materials[swap_mat];
 
-            if (csandMatIsFire(mat)) {
-                tryIgnite(buf, sx, sy);
-                swap_mat = *csandGetMat(buf, sx, sy) & (~MAT_UPDATED_BIT);
-                swap_mat_props = materials[swap_mat];
-            } else if (csandMatIsFire(swap_mat)) {
-                tryIgnite(buf, x, y);
-                mat = *csandGetMat(buf, x, y) & (~MAT_UPDATED_BIT);
-                mat_props = materials[mat];
+            if (mat_props.ignition_prob != 0 && csandMatIsFire(swap_mat)) {
+                return false;
+            }
+
+            if (dy > max_dy) {
+                continue;
             }
 
             if (mat_props.kind != MAT_KIND_SOLID && swap_mat_props.kind != MAT_KIND_SOLID && swap_mat_props.density < mat_props.density) {
-                *csandGetMat(buf, x, y) = swap_mat;
-                *csandGetMat(buf, sx, sy) = mat | MAT_UPDATED_BIT;
+                if (dy == 0 && !blocks && csandIsLevelLiquid(world, x, y, mat)) {
+                    continue;
+                }
+
+                return false;
             }
         }
     }
 
-    for (unsigned int i = 0; i < buf.width * buf.height; i++) {
-        buf.data[i] &= ~MAT_UPDATED_BIT;
-    }
+    return true;
 }
 
-static inline unsigned char *csandGetMat(CsandRenderBuffer buf, unsigned int x, unsigned int y) {
-    return buf.data + buf.width * y + x;
+static inline CsandSpan csandLoadSpan(const unsigned char *bytes) {
+    CsandSpan span = 0;
+    for (unsigned int i = 0; i < CSAND_SPAN_LENGTH; i++) {
+        span |= (CsandSpan)bytes[i] << (i * 8);
+    }
+
+    return span;
 }
 
-static bool csandInBounds(CsandRenderBuffer buf, int x, int y) {
-    return x >= 0 && x < buf.width && y >= 0 && y < buf.height;
+static inline bool csandIsInertMat(unsigned char mat) {
+    return mat == MAT_AIR || mat == MAT_WALL;
 }
 
-static inline bool csandMatIsFire(unsigned char mat) {
-    return mat == MAT_FIRE_GAS || mat == MAT_FIRE_POWDER || mat == MAT_FIRE_LIQUID;
+/* Air does nothing next to air and walls, and neither do walls with something
+ * under them, as long as nobody made them decay or turned walls into
+ * something movable in the developer menu. */
+static bool csandCanSkipInertSpans(void) {
+    return materials[MAT_AIR].decay_prob == 0 &&
+        materials[MAT_WALL].decay_prob == 0 &&
+        materials[MAT_WALL].kind == MAT_KIND_SOLID;
 }
 
-static void tryIgnite(CsandRenderBuffer buf, unsigned int x, unsigned int y) {
-    unsigned char mat = *csandGetMat(buf, x, y);
-    CsandMaterialProperties mat_props = materials[mat];
+/* Checks whether the span starting at x and all the cells it can interact
+ * with are air or walls, with no wall of the span right above air, since
+ * that one may be part of a structure about to fall. Relies on MAT_AIR and
+ * MAT_WALL being 0 and 1, so that a single mask test covers every byte of
+ * the span at once. Spans are aligned, so they never cross a chunk boundary,
+ * or a tile with CSAND_TILED_CHUNKS. */
+static bool csandIsInertSpan(CsandWorld *world, unsigned int x, unsigned int y) {
+    const CsandSpan not_inert_mask = ~CSAND_SPAN_BYTES(MAT_AIR | MAT_WALL);
+    // the bottom edge of the world holds walls up
+    CsandSpan below = CSAND_SPAN_BYTES(MAT_WALL);
+
+    for (int dy = -1; dy <= 0; dy++) {
+        if (!csandInBounds(world, x, y + dy)) {
+            continue;
+        }
 
-    if (!csandChance(mat_props.ignition_prob)) {
-        return;
-    }
+        CsandSpan span = csandLoadSpan(csandGetMat(world, x, y + dy));
+        if (span & not_inert_mask) {
+            return false;
+        }
+
+        if (dy < 0) {
+            below = span;
+        } else if (span & ~below) {
+            return false;
+        }
+
+        if (csandInBounds(world, x - 1, y + dy) && !csandIsInertMat(*csandGetMat(world, x - 1, y + dy))) {
+            return false;
+        }
+
+        if (csandInBounds(world, x + CSAND_SPAN_LENGTH, y + dy) && !csandIsInertMat(*csandGetMat(world, x + CSAND_SPAN_LENGTH, y + dy))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Only goes over the awake cells of the row, so a chunk with a few things
+ * going on costs about as much as those few things. The flags are read again
+ * after every cell, so cells woken further along the row still get their
+ * turn, just like they would in a scan of the whole row. */
+static void csandSimulateChunkRow(CsandWorld *world, CsandChunk *chunk, unsigned int y, bool skip_inert_spans, bool reverse) {
+    unsigned int row = y & CSAND_CHUNK_MASK;
+    unsigned int start_x = chunk->x << CSAND_CHUNK_SIZE_LOG2;
+    unsigned int end_x = csandUiMin(start_x + CSAND_CHUNK_SIZE, world->width);
+    // the row only goes one way, so a span is done with once it's left
+    unsigned int checked_span = CSAND_CHUNK_SIZE;
+
+    unsigned int first = reverse ? csandChunkPrevAwake(chunk, row, CSAND_CHUNK_SIZE - 1) : csandChunkNextAwake(chunk, row, 0);
+    for (unsigned int i = first; i < CSAND_CHUNK_SIZE; i = reverse ? csandChunkPrevAwake(chunk, row, i - 1) : csandChunkNextAwake(chunk, row, i + 1)) {
+        unsigned int x = start_x + i;
+        unsigned int span_start = i & ~(CSAND_SPAN_LENGTH - 1);
+
+        if (skip_inert_spans && span_start != checked_span) {
+            checked_span = span_start;
+            unsigned int span_end = span_start + CSAND_SPAN_LENGTH;
+
+            if (start_x + span_end <= end_x && csandIsInertSpan(world, start_x + span_start, y)) {
+                // cells of the span already gone over are left as they are
+                unsigned int settle_start = reverse ? span_start : i;
+                unsigned int settle_end = reverse ? i + 1 : span_end;
+                for (unsigned int j = settle_start; j < settle_end; j++) {
+                    if (csandChunkIsAwake(chunk, (row << CSAND_CHUNK_SIZE_LOG2) + j)) {
+                        csandChunkSettle(chunk, (row << CSAND_CHUNK_SIZE_LOG2) + j);
+                    }
+                }
+
+                i = reverse ? span_start : span_end - 1;
+                continue;
+            }
+        }
+
+        unsigned char mat = *csandGetMat(world, x, y);
+        if (mat & MAT_UPDATED_BIT) {
+            continue;
+        }
+
+        particle_kernels[mat](world, x, y, mat);
+
+        if (*csandGetMat(world, x, y) == mat && csandCanSettle(world, x, y, mat, false)) {
+            csandChunkSettle(chunk, (row << CSAND_CHUNK_SIZE_LOG2) + i);
+        }
+    }
+}
+
+// stands in for cells past the edge of the world, which act like walls
+#define CSAND_BLOCK_EDGE MATERIALS_COUNT
+
+// cells of a block, in this order
+enum {
+    CSAND_BLOCK_BOTTOM_LEFT,
+    CSAND_BLOCK_BOTTOM_RIGHT,
+    CSAND_BLOCK_TOP_LEFT,
+    CSAND_BLOCK_TOP_RIGHT,
+    CSAND_BLOCK_AREA,
+};
+
+static inline bool csandBlockIsSolid(unsigned int mat) {
+    return mat == CSAND_BLOCK_EDGE || materials[mat].kind == MAT_KIND_SOLID;
+}
+
+static inline bool csandBlockCanSink(unsigned int top, unsigned int bottom) {
+    return !csandBlockIsSolid(top) && !csandBlockIsSolid(bottom) && materials[top].density > materials[bottom].density;
+}
+
+// only fluids flow sideways, into anything lighter that isn't solid
+static inline bool csandBlockCanSpread(unsigned int a, unsigned int b) {
+    if (csandBlockIsSolid(a) || csandBlockIsSolid(b)) {
+        return false;
+    }
+
+    return (materials[a].density > materials[b].density && materials[a].kind == MAT_KIND_FLUID) ||
+        (materials[b].density > materials[a].density && materials[b].kind == MAT_KIND_FLUID);
+}
+
+static inline bool csandBlockSwap(unsigned int *mats, int a, int b) {
+    unsigned int tmp = mats[a];
+    mats[a] = mats[b];
+    mats[b] = tmp;
+    return true;
+}
+
+// like tryIgnite, but only the cells right around are looked at for air
+static bool csandTouchesFireAndAir(CsandWorld *world, unsigned int x, unsigned int y) {
+    bool fire = false;
+    bool air = false;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (csandInBounds(world, x + dx, y + dy)) {
+                unsigned char mat = *csandGetMat(world, x + dx, y + dy);
+                fire = fire || csandMatIsFire(mat);
+                air = air || mat == MAT_AIR;
+            }
+        }
+    }
+
+    return fire && air;
+}
+
+// decay or catching fire, neither moves anything, so the neighbors can be read as they were
+static unsigned int csandReactInBlock(CsandWorld *world, unsigned int x, unsigned int y, unsigned int mat, uint32_t seed) {
+    if (mat == CSAND_BLOCK_EDGE) {
+        return mat;
+    }
+
+    CsandMaterialProperties mat_props = materials[mat];
+    if (csandHashChance(csandHashCell(x, y, seed, 1), mat_props.decay_prob)) {
+        return mat_props.decay_mat;
+    }
+
+    if (!csandMatIsFire(mat) && csandHashChance(csandHashCell(x, y, seed, 2), mat_props.ignition_prob) && csandTouchesFireAndAir(world, x, y)) {
+        bool fluid = mat_props.kind == MAT_KIND_FLUID;
+        return csandHashCell(x, y, seed, 3) & 1 ? MAT_FIRE_GAS : fluid ? MAT_FIRE_LIQUID : MAT_FIRE_POWDER;
+    }
+
+    return mat;
+}
+
+/* The same rule as sim.frag: reactions first, then heavier cells sink, straight
+ * down if they can and diagonally otherwise, and if nothing sank, fluids
+ * spread sideways half of the time. The randomness comes from the position
+ * and the seed, so blocks can go in any order. Does nothing to blocks where
+ * every cell is settled. */
+static void csandSimulateBlock(CsandWorld *world, unsigned int x, unsigned int y, uint32_t seed) {
+    unsigned int xs[CSAND_BLOCK_AREA] = {x, x + 1, x, x + 1};
+    unsigned int ys[CSAND_BLOCK_AREA] = {y, y, y + 1, y + 1};
+    unsigned int mats[CSAND_BLOCK_AREA];
+    CsandChunk *chunks[CSAND_BLOCK_AREA] = {NULL};
+    bool settled = true;
+
+    for (int i = 0; i < CSAND_BLOCK_AREA; i++) {
+        if (!csandInBounds(world, xs[i], ys[i])) {
+            mats[i] = CSAND_BLOCK_EDGE;
+            continue;
+        }
+
+        chunks[i] = csandWorldGetChunk(world, xs[i] >> CSAND_CHUNK_SIZE_LOG2, ys[i] >> CSAND_CHUNK_SIZE_LOG2);
+        mats[i] = chunks[i]->cells[csandChunkCellIndex(xs[i], ys[i])];
+        settled = settled && !csandChunkIsAwake(chunks[i], csandChunkFlagIndex(xs[i], ys[i]));
+    }
+
+    if (settled) {
+        return;
+    }
+
+    unsigned int old_mats[CSAND_BLOCK_AREA];
+    for (int i = 0; i < CSAND_BLOCK_AREA; i++) {
+        old_mats[i] = mats[i];
+        mats[i] = csandReactInBlock(world, xs[i], ys[i], mats[i], seed);
+    }
+
+    bool moved = false;
+    if (csandBlockCanSink(mats[CSAND_BLOCK_TOP_LEFT], mats[CSAND_BLOCK_BOTTOM_LEFT])) {
+        moved = csandBlockSwap(mats, CSAND_BLOCK_TOP_LEFT, CSAND_BLOCK_BOTTOM_LEFT);
+    }
+    if (csandBlockCanSink(mats[CSAND_BLOCK_TOP_RIGHT], mats[CSAND_BLOCK_BOTTOM_RIGHT])) {
+        moved = csandBlockSwap(mats, CSAND_BLOCK_TOP_RIGHT, CSAND_BLOCK_BOTTOM_RIGHT);
+    }
+
+    // diagonals go in a random order, so neither side is favored
+    if (!moved) {
+        bool left_first = csandHashCell(x, y, seed, 4) & 1;
+        int first_top = left_first ? CSAND_BLOCK_TOP_LEFT : CSAND_BLOCK_TOP_RIGHT;
+        int first_bottom = left_first ? CSAND_BLOCK_BOTTOM_RIGHT : CSAND_BLOCK_BOTTOM_LEFT;
+        int second_top = left_first ? CSAND_BLOCK_TOP_RIGHT : CSAND_BLOCK_TOP_LEFT;
+        int second_bottom = left_first ? CSAND_BLOCK_BOTTOM_LEFT : CSAND_BLOCK_BOTTOM_RIGHT;
+
+        if (csandBlockCanSink(mats[first_top], mats[first_bottom])) {
+            moved = csandBlockSwap(mats, first_top, first_bottom);
+        } else if (csandBlockCanSink(mats[second_top], mats[second_bottom])) {
+            moved = csandBlockSwap(mats, second_top, second_bottom);
+        }
+    }
+
+    if (!moved && csandHashCell(x, y, seed, 5) & 1) {
+        if (csandBlockCanSpread(mats[CSAND_BLOCK_BOTTOM_LEFT], mats[CSAND_BLOCK_BOTTOM_RIGHT])) {
+            csandBlockSwap(mats, CSAND_BLOCK_BOTTOM_LEFT, CSAND_BLOCK_BOTTOM_RIGHT);
+        }
+        if (csandBlockCanSpread(mats[CSAND_BLOCK_TOP_LEFT], mats[CSAND_BLOCK_TOP_RIGHT])) {
+            csandBlockSwap(mats, CSAND_BLOCK_TOP_LEFT, CSAND_BLOCK_TOP_RIGHT);
+        }
+    }
+
+    for (int i = 0; i < CSAND_BLOCK_AREA; i++) {
+        if (mats[i] != old_mats[i]) {
+            csandSetMat(world, xs[i], ys[i], mats[i]);
+        }
+    }
+
+    for (int i = 0; i < CSAND_BLOCK_AREA; i++) {
+        if (chunks[i] == NULL || mats[i] != old_mats[i]) {
+            continue;
+        }
+
+        unsigned int index = csandChunkFlagIndex(xs[i], ys[i]);
+        if (csandChunkIsAwake(chunks[i], index) && csandCanSettle(world, xs[i], ys[i], mats[i], true)) {
+            csandChunkSettle(chunks[i], index);
+        }
+    }
+}
+
+/* Goes over every block with a cell in the chunk. Blocks reaching into a
+ * neighbor that was already gone over this tick belong to that one, so no
+ * block runs twice, and blocks still get to run when the chunk they reach
+ * into is asleep. */
+static void csandSimulateChunkBlocks(CsandWorld *world, CsandChunk *chunk, unsigned int offset, uint32_t seed, unsigned int mark) {
+    unsigned int start_x = (chunk->x << CSAND_CHUNK_SIZE_LOG2) - offset;
+    unsigned int start_y = (chunk->y << CSAND_CHUNK_SIZE_LOG2) - offset;
+    unsigned int blocks_count = CSAND_CHUNK_SIZE / 2 + offset;
+
+    for (unsigned int block_y = 0; block_y < blocks_count; block_y++) {
+        unsigned int y = start_y + block_y * 2;
+        bool edge_y = offset && (block_y == 0 || block_y == blocks_count - 1);
+
+        for (unsigned int block_x = 0; block_x < blocks_count; block_x++) {
+            unsigned int x = start_x + block_x * 2;
+            bool edge_x = offset && (block_x == 0 || block_x == blocks_count - 1);
+
+            if (edge_x || edge_y) {
+                bool done = false;
+                for (unsigned int i = 0; i < CSAND_BLOCK_AREA && !done; i++) {
+                    unsigned int cell_x = x + (i & 1);
+                    unsigned int cell_y = y + (i >> 1);
+                    if (csandInBounds(world, cell_x, cell_y)) {
+                        CsandChunk *other = csandWorldGetChunk(world, cell_x >> CSAND_CHUNK_SIZE_LOG2, cell_y >> CSAND_CHUNK_SIZE_LOG2);
+                        done = other != chunk && other->sim_mark == mark;
+                    }
+                }
+
+                if (done) {
+                    continue;
+                }
+            }
+
+            csandSimulateBlock(world, x, y, seed);
+        }
+    }
+
+    chunk->sim_mark = mark;
+}
+
+/* Margolus neighborhood: the grid is split into 2x2 blocks that get updated
+ * on their own, and every other tick the blocks shift by a cell diagonally,
+ * so things can cross from one block into the next. No block looks at what
+ * another one did this tick, which keeps the scan order from biasing
+ * anything and lets blocks go in parallel. Slower than csandSimulateChunkRow
+ * to flow, since nothing moves more than a cell per tick. */
+static void csandSimulateBlocks(CsandWorld *world) {
+    uint32_t seed = csandRand();
+    unsigned int offset = world->tick & 1;
+    // never 0, which new chunks start with
+    unsigned int mark = world->tick | 1u << 31;
+
+    for (unsigned int chunk_y = world->active.min_y; chunk_y < world->active.max_y; chunk_y++) {
+        size_t chunks_count = csandWorldGatherActiveRow(world, chunk_y);
+        for (size_t i = 0; i < chunks_count; i++) {
+            csandSimulateChunkBlocks(world, world->active_row[i], offset, seed, mark);
+        }
+    }
+}
+
+// cells of solid bodies gathered in a tick, bodies that would take it over this are left where they are
+#define CSAND_BODY_MAX_CELLS 8192
+#define CSAND_BODY_MAX_SEEDS 256
+// chunks a body can reach into, bodies that would reach into more wait for the next tick
+#define CSAND_BODY_MAX_CHUNKS 256
+#define CSAND_BODY_MAX_LOOSE 1024
+
+typedef enum {
+    CSAND_BODY_RESTING,
+    CSAND_BODY_FELL,
+    // resting on a body that already fell this tick, or out of marks to tell, waits for the next
+    CSAND_BODY_BLOCKED,
+} CsandBodyStep;
+
+/* Which cells of a chunk belong to the body being gathered, kept out of the
+ * grid so the marks can't be mistaken for materials. The chunk's sim_mark
+ * holds the slot plus 1 meanwhile. */
+typedef struct CsandBodyMarks {
+    CsandChunk *chunk;
+    // block updates keep their own marks there
+    unsigned int saved_sim_mark;
+    // rows of bits, indexed like the awake flags
+    uint64_t gathering[CSAND_CHUNK_SIZE];
+} CsandBodyMarks;
+
+// solids of the body being gathered
+typedef struct CsandBodyCells {
+    CsandVec2Ui pos[CSAND_BODY_MAX_CELLS];
+    unsigned char mats[CSAND_BODY_MAX_CELLS];
+    CsandBodyMarks *marks[CSAND_BODY_MAX_CELLS];
+    size_t count;
+    bool out_of_marks;
+} CsandBodyCells;
+
+// solids that may have lost their support, the ones added while csandUpdateBodies runs are for the next tick
+static CsandVec2Ui body_seeds[CSAND_BODY_MAX_SEEDS];
+static size_t body_seeds_count = 0;
+static CsandBodyCells body_cells;
+static CsandBodyMarks body_marks[CSAND_BODY_MAX_CHUNKS];
+static size_t body_marks_count = 0;
+// solids of resting bodies that may have lost their support this tick
+static CsandVec2Ui body_loose[CSAND_BODY_MAX_LOOSE];
+static size_t body_loose_count = 0;
+
+static const int neighbor_offsets[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+// too many at once and some of them just stay up until they're woken again
+static void csandAddBodySeed(unsigned int x, unsigned int y) {
+    if (body_seeds_count < CSAND_BODY_MAX_SEEDS) {
+        body_seeds[body_seeds_count++] = (CsandVec2Ui){x, y};
+    }
+}
+
+/* Solids of bodies found resting have their sim flag set, and keep it until
+ * a write takes away something that held the body up, see
+ * csandCheckBodySupport. Seeds in them and bodies touching them stop right
+ * away meanwhile. */
+static bool csandIsRestingSolid(CsandWorld *world, unsigned int x, unsigned int y) {
+    CsandChunk *chunk = csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+    if (chunk == NULL || chunk->sim_flags == NULL) {
+        return false;
+    }
+
+    unsigned int index = csandChunkFlagIndex(x, y);
+    return chunk->sim_flags[index >> CSAND_CHUNK_SIZE_LOG2] >> (index & CSAND_CHUNK_MASK) & 1;
+}
+
+static void csandSetRestingSolid(CsandChunk *chunk, unsigned int x, unsigned int y, bool resting) {
+    if (chunk->sim_flags == NULL) {
+        return;
+    }
+
+    unsigned int index = csandChunkFlagIndex(x, y);
+    uint64_t bit = (uint64_t)1 << (index & CSAND_CHUNK_MASK);
+    if (resting) {
+        chunk->sim_flags[index >> CSAND_CHUNK_SIZE_LOG2] |= bit;
+    } else {
+        chunk->sim_flags[index >> CSAND_CHUNK_SIZE_LOG2] &= ~bit;
+    }
+}
+
+// for whenever cells changed without going through csandSetMat
+static void csandForgetRestingBodies(CsandWorld *world) {
+    for (size_t i = 0; i < world->chunk_slots_count; i++) {
+        CsandChunk *chunk = world->chunk_slots[i];
+        if (chunk != NULL && chunk->sim_flags != NULL) {
+            memset(chunk->sim_flags, 0, CSAND_CHUNK_SIZE * sizeof(uint64_t));
+        }
+    }
+}
+
+// NULL if the chunk has no marks yet and there's no room to give it any
+static CsandBodyMarks *csandGetBodyMarks(CsandChunk *chunk, bool create) {
+    // block updates leave marks with the top bit set, which never pass this
+    unsigned int slot = chunk->sim_mark - 1;
+    if (slot < body_marks_count && body_marks[slot].chunk == chunk) {
+        return &body_marks[slot];
+    }
+
+    if (!create || body_marks_count == CSAND_BODY_MAX_CHUNKS) {
+        return NULL;
+    }
+
+    CsandBodyMarks *marks = &body_marks[body_marks_count++];
+    marks->chunk = chunk;
+    marks->saved_sim_mark = chunk->sim_mark;
+    memset(marks->gathering, 0, sizeof(marks->gathering));
+    chunk->sim_mark = body_marks_count;
+    return marks;
+}
+
+static void csandReleaseBodyMarks(void) {
+    for (size_t i = 0; i < body_marks_count; i++) {
+        body_marks[i].chunk->sim_mark = body_marks[i].saved_sim_mark;
+    }
+    body_marks_count = 0;
+}
+
+static bool csandIsBodyCell(CsandChunk *chunk, unsigned int x, unsigned int y) {
+    CsandBodyMarks *marks = csandGetBodyMarks(chunk, false);
+    unsigned int index = csandChunkFlagIndex(x, y);
+    return marks != NULL && marks->gathering[index >> CSAND_CHUNK_SIZE_LOG2] >> (index & CSAND_CHUNK_MASK) & 1;
+}
+
+// false if there's no room for the cell
+static bool csandAddBodyCell(CsandChunk *chunk, unsigned int x, unsigned int y, unsigned char mat) {
+    if (body_cells.count == CSAND_BODY_MAX_CELLS) {
+        return false;
+    }
+
+    CsandBodyMarks *marks = csandGetBodyMarks(chunk, true);
+    if (marks == NULL) {
+        body_cells.out_of_marks = true;
+        return false;
+    }
+
+    unsigned int index = csandChunkFlagIndex(x, y);
+    marks->gathering[index >> CSAND_CHUNK_SIZE_LOG2] |= (uint64_t)1 << (index & CSAND_CHUNK_MASK);
+    body_cells.pos[body_cells.count] = (CsandVec2Ui){x, y};
+    body_cells.mats[body_cells.count] = mat;
+    body_cells.marks[body_cells.count] = marks;
+    body_cells.count++;
+    return true;
+}
+
+// drops the cells from the body being gathered, flagging them as resting or not
+static void csandUnmarkBodyCells(bool resting) {
+    for (size_t i = 0; i < body_cells.count; i++) {
+        unsigned int x = body_cells.pos[i].x;
+        unsigned int y = body_cells.pos[i].y;
+        unsigned int index = csandChunkFlagIndex(x, y);
+        body_cells.marks[i]->gathering[index >> CSAND_CHUNK_SIZE_LOG2] &= ~((uint64_t)1 << (index & CSAND_CHUNK_MASK));
+        if (resting) {
+            csandSetRestingSolid(body_cells.marks[i]->chunk, x, y, true);
+        }
+    }
+
+    body_cells.count = 0;
+    body_cells.out_of_marks = false;
+}
+
+static inline unsigned char csandGetBodyMat(CsandWorld *world, CsandChunk *chunk, unsigned int x, unsigned int y) {
+    return chunk->cells != NULL ? chunk->cells[csandChunkCellIndex(x, y)] : csandWorldGetMat(world, x, y);
+}
+
+/* Adds the cell to the body being gathered if it's a solid that isn't in
+ * it yet. Returns false if the body can't move because of the cell: it's
+ * part of a body found resting, there's no room left for it, or its chunk
+ * is packed or paged out. Only reads the grid, so chunks that are missing
+ * stay missing. */
+static bool csandBodyVisit(CsandWorld *world, unsigned int x, unsigned int y) {
+    // missing chunks are all air
+    CsandChunk *chunk = csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+    if (chunk == NULL) {
+        return true;
+    }
+
+    unsigned char mat = csandGetBodyMat(world, chunk, x, y);
+    if (mat & MAT_UPDATED_BIT || !csandIsSolidMat(mat) || csandIsBodyCell(chunk, x, y)) {
+        return true;
+    }
+
+    if (chunk->cells == NULL || csandIsRestingSolid(world, x, y)) {
+        return false;
+    }
+
+    return csandAddBodyCell(chunk, x, y, mat);
+}
+
+// like csandBodyVisit, but gathers every solid of the body whatever its flags say
+static bool csandLoosenVisit(CsandWorld *world, unsigned int x, unsigned int y) {
+    CsandChunk *chunk = csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+    if (chunk == NULL) {
+        return true;
+    }
+
+    unsigned char mat = csandGetBodyMat(world, chunk, x, y);
+    if (!csandIsSolidMat(mat) || csandIsBodyCell(chunk, x, y)) {
+        return true;
+    }
+
+    return csandAddBodyCell(chunk, x, y, mat);
+}
+
+/* The solid may have lost what held its body up. Bodies nothing is known
+ * about yet just get seeded, the verdict of resting ones has to go first,
+ * which waits for csandLoosenBodies. */
+static void csandLoosenBody(CsandWorld *world, unsigned int x, unsigned int y) {
+    if (!csandIsRestingSolid(world, x, y)) {
+        csandAddBodySeed(x, y);
+    } else if (body_loose_count < CSAND_BODY_MAX_LOOSE) {
+        body_loose[body_loose_count++] = (CsandVec2Ui){x, y};
+    } else {
+        // better to look at every body again than to leave one hanging
+        csandForgetRestingBodies(world);
+    }
+}
+
+/* A write replaced old with mat. A new solid may hang in the air, and one
+ * that's gone or a cell that stopped holding up the solid above may have
+ * left bodies without support. Everything else leaves bodies as they are,
+ * which keeps the check to a few reads for most moves. */
+static void csandCheckBodySupport(CsandWorld *world, unsigned int x, unsigned int y, unsigned char old, unsigned char mat) {
+    bool was_solid = csandIsSolidMat(old);
+    bool is_solid = csandIsSolidMat(mat);
+
+    if (is_solid && !was_solid) {
+        csandAddBodySeed(x, y);
+    } else if (was_solid && !is_solid) {
+        // the solids around may have hung from it
+        CsandChunk *chunk = csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+        csandSetRestingSolid(chunk, x, y, false);
+        for (int j = 0; j < 4; j++) {
+            unsigned int nx = x + neighbor_offsets[j][0];
+            unsigned int ny = y + neighbor_offsets[j][1];
+            if (csandInBounds(world, nx, ny) && csandIsSolidMat(*csandGetMat(world, nx, ny))) {
+                csandLoosenBody(world, nx, ny);
+            }
+        }
+    } else if (!is_solid && csandInBounds(world, x, y + 1)) {
+        old &= ~MAT_UPDATED_BIT;
+        mat &= ~MAT_UPDATED_BIT;
+        if (materials[mat].kind == MAT_KIND_POWDER || (materials[old].kind != MAT_KIND_POWDER && materials[old].density <= materials[mat].density)) {
+            return;
+        }
+
+        unsigned char above = *csandGetMat(world, x, y + 1) & (~MAT_UPDATED_BIT);
+        if (csandIsSolidMat(above) && csandCanRestOn(old, above) && !csandCanRestOn(mat, above)) {
+            csandLoosenBody(world, x, y + 1);
+        }
+    }
+}
+
+/* Drops the verdict of every resting body that may have lost its support
+ * since the last call, and seeds the ones that aren't too big to fall. A
+ * body is only walked once however many of its cells got loosened, the
+ * marks stay until all of them are done. */
+static void csandLoosenBodies(CsandWorld *world) {
+    if (world->sim_flags_lost) {
+        // what's left of the flags may only cover part of a body now
+        csandForgetRestingBodies(world);
+        world->sim_flags_lost = false;
+    }
+
+    for (size_t i = 0; i < body_loose_count; i++) {
+        unsigned int x = body_loose[i].x;
+        unsigned int y = body_loose[i].y;
+        CsandChunk *chunk = csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+        if (!csandIsRestingSolid(world, x, y) || csandIsBodyCell(chunk, x, y)) {
+            continue;
+        }
+
+        bool gathered = csandLoosenVisit(world, x, y);
+        for (size_t j = 0; j < body_cells.count && gathered; j++) {
+            for (int k = 0; k < 4 && gathered; k++) {
+                unsigned int nx = body_cells.pos[j].x + neighbor_offsets[k][0];
+                unsigned int ny = body_cells.pos[j].y + neighbor_offsets[k][1];
+                gathered = !csandInBounds(world, nx, ny) || csandLoosenVisit(world, nx, ny);
+            }
+        }
+
+        if (body_cells.out_of_marks) {
+            csandForgetRestingBodies(world);
+            for (size_t j = i; j < body_loose_count; j++) {
+                csandAddBodySeed(body_loose[j].x, body_loose[j].y);
+            }
+            break;
+        }
+
+        // bodies too big to gather can't fall anyway
+        if (gathered) {
+            for (size_t j = 0; j < body_cells.count; j++) {
+                csandSetRestingSolid(body_cells.marks[j]->chunk, body_cells.pos[j].x, body_cells.pos[j].y, false);
+            }
+            csandAddBodySeed(x, y);
+        }
+        body_cells.count = 0;
+    }
+
+    body_cells.count = 0;
+    body_cells.out_of_marks = false;
+    body_loose_count = 0;
+    csandReleaseBodyMarks();
+}
+
+/* Gathers the solids connected to the cell into a body and moves all of it
+ * a cell down if nothing holds it up. Bodies found resting get flagged, so
+ * other seeds in them stop right away. Solids that already fell this tick
+ * have the updated bit set and count as separate bodies. */
+static CsandBodyStep csandStepBody(CsandWorld *world, unsigned int x, unsigned int y) {
+    static CsandVec2Ui sorted[CSAND_BODY_MAX_CELLS];
+    static unsigned int row_starts[CSAND_BODY_MAX_CELLS + 1];
+
+    bool supported = !csandBodyVisit(world, x, y);
+    bool blocked = false;
+    unsigned int min_y = y;
+    unsigned int max_y = y;
+
+    for (size_t i = 0; i < body_cells.count && !supported; i++) {
+        unsigned int cell_x = body_cells.pos[i].x;
+        unsigned int cell_y = body_cells.pos[i].y;
+        min_y = csandUiMin(min_y, cell_y);
+        max_y = cell_y > max_y ? cell_y : max_y;
+
+        if (!csandInBounds(world, cell_x, cell_y - 1)) {
+            supported = true;
+            break;
+        }
+
+        // solids below that aren't marked yet are part of the body too, they just haven't been gathered
+        unsigned char below = csandWorldGetMat(world, cell_x, cell_y - 1);
+        if (!csandIsSolidMat(below)) {
+            supported = csandCanRestOn(below & (~MAT_UPDATED_BIT), body_cells.mats[i]);
+        } else if (below & MAT_UPDATED_BIT) {
+            blocked = true;
+        } else if (csandIsRestingSolid(world, cell_x, cell_y - 1)) {
+            supported = true;
+        }
+
+        for (int j = 0; j < 4 && !supported; j++) {
+            unsigned int nx = cell_x + neighbor_offsets[j][0];
+            unsigned int ny = cell_y + neighbor_offsets[j][1];
+            supported = csandInBounds(world, nx, ny) && !csandBodyVisit(world, nx, ny);
+        }
+    }
+
+    if (body_cells.out_of_marks) {
+        csandUnmarkBodyCells(false);
+        return CSAND_BODY_BLOCKED;
+    }
+
+    if (supported || body_cells.count == 0) {
+        csandUnmarkBodyCells(true);
+        return CSAND_BODY_RESTING;
+    }
+
+    // the cells are about to move, so they can't stay marked
+    size_t count = body_cells.count;
+    memcpy(sorted, body_cells.pos, count * sizeof(sorted[0]));
+    csandUnmarkBodyCells(false);
+    if (blocked) {
+        return CSAND_BODY_BLOCKED;
+    }
+
+    // lowest rows first, so every cell moves into room the one below it just left
+    unsigned int rows = max_y - min_y + 1;
+    memset(row_starts, 0, (rows + 1) * sizeof(row_starts[0]));
+    for (size_t i = 0; i < count; i++) {
+        row_starts[sorted[i].y - min_y + 1]++;
+    }
+    for (unsigned int row = 0; row < rows; row++) {
+        row_starts[row + 1] += row_starts[row];
+    }
+    for (size_t i = 0; i < count; i++) {
+        body_cells.pos[row_starts[sorted[i].y - min_y]++] = sorted[i];
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        unsigned int cell_x = body_cells.pos[i].x;
+        unsigned int cell_y = body_cells.pos[i].y;
+        // what's below may be in a chunk that isn't loaded yet
+        unsigned char cell = *csandGetMat(world, cell_x, cell_y);
+        csandWorldMoveMat(world, cell_x, cell_y, csandWorldGetMat(world, cell_x, cell_y - 1));
+        csandWorldMoveMat(world, cell_x, cell_y - 1, cell | MAT_UPDATED_BIT);
+    }
+
+    return CSAND_BODY_FELL;
+}
+
+/* Solids aren't simulated cell by cell, a body of them only gets looked at
+ * when a write may have taken away its support, see csandCheckBodySupport,
+ * or when one of its cells was woken without anything known about it, like
+ * right after a scene is generated. A body that fell or couldn't tell gets
+ * looked at again next tick, until it lands. */
+static void csandUpdateBodies(CsandWorld *world) {
+    size_t count = body_seeds_count;
+    for (size_t i = 0; i < count; i++) {
+        unsigned int x = body_seeds[i].x;
+        unsigned int y = body_seeds[i].y;
+        switch (csandStepBody(world, x, y)) {
+            case CSAND_BODY_RESTING:
+                break;
+            case CSAND_BODY_FELL:
+                csandAddBodySeed(x, y - 1);
+                break;
+            case CSAND_BODY_BLOCKED:
+                csandAddBodySeed(x, y);
+                break;
+        }
+    }
+
+    memmove(body_seeds, body_seeds + count, (body_seeds_count - count) * sizeof(body_seeds[0]));
+    body_seeds_count -= count;
+    csandReleaseBodyMarks();
+}
+
+/* Goes over row y of every chunk in the active row, in the direction the
+ * scan order picks. None of the orders roll any dice, they only depend on
+ * the tick and the row, so a seed still plays out the same every time. */
+static void csandSimulateRow(CsandWorld *world, size_t chunks_count, unsigned int y, bool skip_inert_spans) {
+    bool reverse = false;
+    switch (scan_order) {
+        case CSAND_SCAN_LEFT_TO_RIGHT:
+            break;
+        case CSAND_SCAN_ALTERNATING:
+            reverse = (world->tick ^ y) & 1;
+            break;
+        case CSAND_SCAN_SHUFFLED:
+            // a Fisher-Yates shuffle with the dice hashed from the row, in place since every row shuffles again
+            for (size_t i = chunks_count - 1; i > 0; i--) {
+                size_t j = csandHashCell(i, y, world->tick, 6) % (i + 1);
+                CsandChunk *chunk = world->active_row[i];
+                world->active_row[i] = world->active_row[j];
+                world->active_row[j] = chunk;
+            }
+            break;
+        case CSAND_SCAN_ORDERS_COUNT:
+            break;
+    }
+
+    for (size_t i = 0; i < chunks_count; i++) {
+        CsandChunk *chunk = world->active_row[reverse ? chunks_count - 1 - i : i];
+        if (scan_order == CSAND_SCAN_SHUFFLED) {
+            reverse = csandHashCell(chunk->x, y, world->tick, 7) & 1;
+        }
+
+        csandSimulateChunkRow(world, chunk, y, skip_inert_spans, reverse);
+    }
+}
+
+static void csandSimulate(CsandWorld *world) {
+    if (block_updates) {
+        csandSimulateBlocks(world);
+        csandLoosenBodies(world);
+        csandWorldEndTick(world);
+        return;
+    }
+
+    bool skip_inert_spans = csandCanSkipInertSpans();
+
+    // rows of cells still go bottom to top across the whole active region
+    for (unsigned int chunk_y = world->active.min_y; chunk_y < world->active.max_y; chunk_y++) {
+        size_t chunks_count = csandWorldGatherActiveRow(world, chunk_y);
+        if (chunks_count == 0) {
+            continue;
+        }
+
+        unsigned int start_y = chunk_y << CSAND_CHUNK_SIZE_LOG2;
+        unsigned int end_y = csandUiMin(start_y + CSAND_CHUNK_SIZE, world->height);
+
+        for (unsigned int y = start_y; y < end_y; y++) {
+            csandSimulateRow(world, chunks_count, y, skip_inert_spans);
+        }
+    }
+
+    csandLoosenBodies(world);
+    csandUpdateBodies(world);
+
+    // cells marked as updated were written during this tick, so they can't be settled
+    for (size_t i = 0; i < world->touched_count; i++) {
+        CsandChunk *chunk = world->touched[i];
+        if (chunk->cells == NULL || chunk->awake_count == 0) {
+            continue;
+        }
+
+        for (unsigned int row = 0; row < CSAND_CHUNK_SIZE; row++) {
+            for (unsigned int x = csandChunkNextAwake(chunk, row, 0); x < CSAND_CHUNK_SIZE; x = csandChunkNextAwake(chunk, row, x + 1)) {
+                chunk->cells[csandChunkCellIndex(x, row)] &= ~MAT_UPDATED_BIT;
+            }
+        }
+    }
+
+    csandWorldEndTick(world);
+}
+
+static inline unsigned char *csandGetMat(CsandWorld *world, unsigned int x, unsigned int y) {
+    return csandWorldCell(world, x, y);
+}
+
+// all writes to the grid have to go through here, so that the neighbors get woken up
+static inline void csandSetMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat) {
+    CsandChunk *chunk = csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+    unsigned char old = chunk != NULL ? csandGetBodyMat(world, chunk, x, y) : MAT_AIR;
+    csandWorldSetMat(world, x, y, mat);
+    // and so that bodies that lost their support fall
+    if ((old ^ mat) & (~MAT_UPDATED_BIT)) {
+        csandCheckBodySupport(world, x, y, old, mat);
+    }
+}
+
+static inline bool csandInBounds(CsandWorld *world, unsigned int x, unsigned int y) {
+    return csandWorldInBounds(world, x, y);
+}
+
+static inline bool csandMatIsFire(unsigned char mat) {
+    return mat == MAT_FIRE_GAS || mat == MAT_FIRE_POWDER || mat == MAT_FIRE_LIQUID;
+}
+
+// hydrogen cells a single explosion burns, anything past that goes up with the next one
+#define CSAND_EXPLOSION_MAX_CELLS 16384
+// burned cells it takes to throw things one more cell away
+#define CSAND_EXPLOSION_CELLS_PER_PUSH 32
+#define CSAND_EXPLOSION_MAX_PUSH 12
+
+static inline int csandUiCompare(unsigned int a, unsigned int b) {
+    return (a > b) - (a < b);
+}
+
+// gases no heavier than air, which whatever an explosion throws around can fly through
+static inline bool csandIsOpenMat(unsigned char mat) {
+    return materials[mat].kind == MAT_KIND_FLUID && materials[mat].density <= materials[MAT_AIR].density;
+}
+
+/* Moves a particle next to an explosion up to distance cells away from its
+ * center, through gas, stopping at the first thing in the way. */
+static void csandExplosionPush(CsandWorld *world, unsigned int x, unsigned int y, int dx, int dy, unsigned int distance) {
+    unsigned char mat = csandWorldGetMat(world, x, y);
+    if (mat & MAT_UPDATED_BIT || csandIsOpenMat(mat) || materials[mat].kind == MAT_KIND_SOLID || csandMatIsFire(mat)) {
+        return;
+    }
+
+    unsigned int tx = x;
+    unsigned int ty = y;
+    for (unsigned int i = 0; i < distance; i++) {
+        if (!csandInBounds(world, tx + dx, ty + dy) || !csandIsOpenMat(csandWorldGetMat(world, tx + dx, ty + dy) & (~MAT_UPDATED_BIT))) {
+            break;
+        }
+
+        tx += dx;
+        ty += dy;
+    }
+
+    if (tx != x || ty != y) {
+        csandSetMat(world, x, y, csandWorldGetMat(world, tx, ty));
+        csandSetMat(world, tx, ty, mat | MAT_UPDATED_BIT);
+    }
+}
+
+/* Burns the whole cloud of hydrogen gas connected to the cell at once, rather
+ * than letting fire eat through it a cell and a few rolls at a time, then
+ * throws the particles around it outwards. The bigger the cloud, the
+ * further they fly. Cells are looked up through the world, so a cloud can
+ * reach into chunks that aren't being simulated. */
+static void csandExplode(CsandWorld *world, unsigned int x, unsigned int y) {
+    static CsandVec2Ui cells[CSAND_EXPLOSION_MAX_CELLS];
+
+    // burning a cell is what marks it as visited, the burned cells double as the queue
+    size_t count = 1;
+    cells[0] = (CsandVec2Ui){x, y};
+    csandSetMat(world, x, y, MAT_FIRE_GAS | MAT_UPDATED_BIT);
+    uint64_t sum_x = x;
+    uint64_t sum_y = y;
+
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < 4 && count < CSAND_EXPLOSION_MAX_CELLS; j++) {
+            unsigned int nx = cells[i].x + neighbor_offsets[j][0];
+            unsigned int ny = cells[i].y + neighbor_offsets[j][1];
+            if (csandInBounds(world, nx, ny) && (csandWorldGetMat(world, nx, ny) & (~MAT_UPDATED_BIT)) == MAT_HYDROGEN_GAS) {
+                csandSetMat(world, nx, ny, MAT_FIRE_GAS | MAT_UPDATED_BIT);
+                cells[count++] = (CsandVec2Ui){nx, ny};
+                sum_x += nx;
+                sum_y += ny;
+            }
+        }
+    }
+
+    unsigned int center_x = sum_x / count;
+    unsigned int center_y = sum_y / count;
+    unsigned int distance = csandUiMin(1 + count / CSAND_EXPLOSION_CELLS_PER_PUSH, CSAND_EXPLOSION_MAX_PUSH);
+
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < 4; j++) {
+            unsigned int nx = cells[i].x + neighbor_offsets[j][0];
+            unsigned int ny = cells[i].y + neighbor_offsets[j][1];
+            int dx = csandUiCompare(nx, center_x);
+            int dy = csandUiCompare(ny, center_y);
+            if (csandInBounds(world, nx, ny) && (dx != 0 || dy != 0)) {
+                csandExplosionPush(world, nx, ny, dx, dy, distance);
+            }
+        }
+    }
+}
+
+static void tryIgnite(CsandWorld *world, unsigned int x, unsigned int y) {
+    unsigned char mat = *csandGetMat(world, x, y);
+    CsandMaterialProperties mat_props = materials[mat];
+
+    if (!csandChance(mat_props.ignition_prob)) {
+        return;
+    }
+
+    const int air_range = 2;
+    for (int dy = air_range; dy >= -air_range; dy--) {
+        for (int dx = -air_range; dx <= air_range; dx++) {
+            if (!(dx == 0 && dy == 0) && csandInBounds(world, x + dx, y + dy) && *csandGetMat(world, x + dx, y + dy) == MAT_AIR) {
+                if (mat == MAT_HYDROGEN_GAS) {
+                    csandExplode(world, x, y);
+                    return;
+                }
 
-    const int air_range = 2;
-    for (int dy = air_range; dy >= -air_range; dy--) {
-        for (int dx = -air_range; dx <= air_range; dx++) {
-            if (!(dx == 0 && dy == 0) && csandInBounds(buf, x + dx, y + dy) && *csandGetMat(buf, x + dx, y + dy) == MAT_AIR) {
                 switch (mat_props.kind) {
                     case MAT_KIND_SOLID:
                     case MAT_KIND_POWDER:
@@ -614,7 +2387,7 @@ static void tryIgnite(CsandRenderBuffer buf, unsigned int x, unsigned int y) {
                         break;
                 }
 
-                *csandGetMat(buf, x, y) = mat | MAT_UPDATED_BIT;
+                csandSetMat(world, x, y, mat | MAT_UPDATED_BIT);
                 return;
             }
         }
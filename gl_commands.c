@@ -0,0 +1,260 @@
+/* GL calls that return nothing get recorded into a command buffer instead of
+ * crossing into JS one by one. gles2.js replays the whole buffer at once at
+ * the end of the frame, when it fills up, and before any GL call that isn't
+ * batched, so the order of calls is kept. Web build only, the native build
+ * calls GL directly. */
+#include "wasm_libc.h"
+#include <GLES2/gl2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// in 32-bit words
+#define CSAND_GL_COMMAND_BUFFER_SIZE (64 * 1024)
+
+// keep in sync with GLES2Context.#commands in gles2.js
+typedef enum {
+    CSAND_GL_BLEND_EQUATION,
+    CSAND_GL_BLEND_FUNC,
+    CSAND_GL_ENABLE,
+    CSAND_GL_DISABLE,
+    CSAND_GL_VIEWPORT,
+    CSAND_GL_CLEAR_COLOR,
+    CSAND_GL_CLEAR,
+    CSAND_GL_BIND_BUFFER,
+    CSAND_GL_BUFFER_DATA,
+    CSAND_GL_BUFFER_SUB_DATA,
+    CSAND_GL_VERTEX_ATTRIB_POINTER,
+    CSAND_GL_ENABLE_VERTEX_ATTRIB_ARRAY,
+    CSAND_GL_USE_PROGRAM,
+    CSAND_GL_DRAW_ARRAYS,
+    CSAND_GL_DRAW_ELEMENTS,
+    CSAND_GL_ACTIVE_TEXTURE,
+    CSAND_GL_BIND_TEXTURE,
+    CSAND_GL_TEX_PARAMETERI,
+    CSAND_GL_PIXEL_STOREI,
+    CSAND_GL_UNIFORM1I,
+    CSAND_GL_UNIFORM2I,
+    CSAND_GL_UNIFORM2F,
+    CSAND_GL_SCISSOR,
+    CSAND_GL_TEX_IMAGE_2D,
+    CSAND_GL_TEX_SUB_IMAGE_2D,
+    CSAND_GL_BIND_FRAMEBUFFER,
+    CSAND_GL_FRAMEBUFFER_TEXTURE_2D,
+    CSAND_GL_BIND_VERTEX_ARRAY_OES,
+} CsandGlOpcode;
+
+/* Each command starts with a word holding the opcode in the low byte and
+ * the length of the whole command in words above it, followed by one word
+ * per argument and then the copied payload, if any. */
+typedef struct CsandGlCommandBuffer {
+    // reset to 0 by the JS side after replaying
+    uint32_t length;
+    uint32_t words[CSAND_GL_COMMAND_BUFFER_SIZE];
+} CsandGlCommandBuffer;
+
+// imported from gles2.js
+void csandGlSetCommandBuffer(CsandGlCommandBuffer *buffer);
+void csandGlFlushCommands(void);
+
+static CsandGlCommandBuffer command_buffer = {0};
+static bool command_buffer_registered = false;
+static GLint unpack_alignment = 4;
+
+static uint32_t csandGlFloatBits(GLfloat value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uint32_t csandGlPointerBits(const void *ptr) {
+    return (uint32_t)(uintptr_t)ptr;
+}
+
+/* The payload is whatever the argument at payload_arg points to. It gets
+ * copied, because the caller is free to reuse the memory before the replay.
+ * Payloads too big for the buffer are replayed right away instead. */
+static void csandGlRecord(CsandGlOpcode opcode, uint32_t *args, size_t args_count, size_t payload_arg, const void *payload, size_t payload_size) {
+    if (!command_buffer_registered) {
+        csandGlSetCommandBuffer(&command_buffer);
+        command_buffer_registered = true;
+    }
+
+    size_t payload_words = payload != NULL ? (payload_size + 3) / 4 : 0;
+    bool copy_payload = 1 + args_count + payload_words <= CSAND_GL_COMMAND_BUFFER_SIZE;
+    size_t words = 1 + args_count + (copy_payload ? payload_words : 0);
+
+    if (command_buffer.length + words > CSAND_GL_COMMAND_BUFFER_SIZE) {
+        csandGlFlushCommands();
+    }
+
+    uint32_t *command = command_buffer.words + command_buffer.length;
+    command_buffer.length += words;
+
+    if (payload != NULL && copy_payload) {
+        uint32_t *copy = command + 1 + args_count;
+        memcpy(copy, payload, payload_size);
+        args[payload_arg] = csandGlPointerBits(copy);
+    }
+
+    command[0] = (uint32_t)opcode | (uint32_t)words << 8;
+    memcpy(command + 1, args, args_count * sizeof(uint32_t));
+
+    if (payload != NULL && !copy_payload) {
+        csandGlFlushCommands();
+    }
+}
+
+#define CSAND_GL_RECORD(opcode, ...) do { \
+        uint32_t args[] = {__VA_ARGS__}; \
+        csandGlRecord(opcode, args, sizeof(args) / sizeof(args[0]), 0, NULL, 0); \
+    } while (0)
+
+static size_t csandGlPixelSize(GLenum format, GLenum type) {
+    if (type != GL_UNSIGNED_BYTE) {
+        // all the packed types fit a pixel into a short
+        return 2;
+    }
+
+    switch (format) {
+        case GL_LUMINANCE_ALPHA:
+            return 2;
+        case GL_RGB:
+            return 3;
+        case GL_RGBA:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+// how much the pixels take up in memory, with every row but the last one padded to the unpack alignment
+static size_t csandGlImageSize(GLsizei width, GLsizei height, GLenum format, GLenum type) {
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    size_t row_size = (size_t)width * csandGlPixelSize(format, type);
+    size_t stride = (row_size + unpack_alignment - 1) / unpack_alignment * unpack_alignment;
+    return stride * (height - 1) + row_size;
+}
+
+void glBlendEquation(GLenum mode) {
+    CSAND_GL_RECORD(CSAND_GL_BLEND_EQUATION, mode);
+}
+
+void glBlendFunc(GLenum sfactor, GLenum dfactor) {
+    CSAND_GL_RECORD(CSAND_GL_BLEND_FUNC, sfactor, dfactor);
+}
+
+void glEnable(GLenum cap) {
+    CSAND_GL_RECORD(CSAND_GL_ENABLE, cap);
+}
+
+void glDisable(GLenum cap) {
+    CSAND_GL_RECORD(CSAND_GL_DISABLE, cap);
+}
+
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    CSAND_GL_RECORD(CSAND_GL_VIEWPORT, x, y, width, height);
+}
+
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha) {
+    CSAND_GL_RECORD(CSAND_GL_CLEAR_COLOR, csandGlFloatBits(red), csandGlFloatBits(green), csandGlFloatBits(blue), csandGlFloatBits(alpha));
+}
+
+void glClear(GLbitfield mask) {
+    CSAND_GL_RECORD(CSAND_GL_CLEAR, mask);
+}
+
+void glBindBuffer(GLenum target, GLuint buffer) {
+    CSAND_GL_RECORD(CSAND_GL_BIND_BUFFER, target, buffer);
+}
+
+void glBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+    uint32_t args[] = {target, size, csandGlPointerBits(data), usage};
+    csandGlRecord(CSAND_GL_BUFFER_DATA, args, 4, 2, data, size);
+}
+
+void glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+    uint32_t args[] = {target, offset, size, csandGlPointerBits(data)};
+    csandGlRecord(CSAND_GL_BUFFER_SUB_DATA, args, 4, 3, data, size);
+}
+
+void glVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void *pointer) {
+    CSAND_GL_RECORD(CSAND_GL_VERTEX_ATTRIB_POINTER, index, size, type, normalized, stride, csandGlPointerBits(pointer));
+}
+
+void glEnableVertexAttribArray(GLuint index) {
+    CSAND_GL_RECORD(CSAND_GL_ENABLE_VERTEX_ATTRIB_ARRAY, index);
+}
+
+void glUseProgram(GLuint program) {
+    CSAND_GL_RECORD(CSAND_GL_USE_PROGRAM, program);
+}
+
+void glDrawArrays(GLenum mode, GLint first, GLsizei count) {
+    CSAND_GL_RECORD(CSAND_GL_DRAW_ARRAYS, mode, first, count);
+}
+
+void glDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+    CSAND_GL_RECORD(CSAND_GL_DRAW_ELEMENTS, mode, count, type, csandGlPointerBits(indices));
+}
+
+void glActiveTexture(GLenum texture) {
+    CSAND_GL_RECORD(CSAND_GL_ACTIVE_TEXTURE, texture);
+}
+
+void glBindTexture(GLenum target, GLuint texture) {
+    CSAND_GL_RECORD(CSAND_GL_BIND_TEXTURE, target, texture);
+}
+
+void glTexParameteri(GLenum target, GLenum pname, GLint param) {
+    CSAND_GL_RECORD(CSAND_GL_TEX_PARAMETERI, target, pname, param);
+}
+
+void glPixelStorei(GLenum pname, GLint param) {
+    if (pname == GL_UNPACK_ALIGNMENT) {
+        unpack_alignment = param;
+    }
+
+    CSAND_GL_RECORD(CSAND_GL_PIXEL_STOREI, pname, param);
+}
+
+void glUniform1i(GLint location, GLint v0) {
+    CSAND_GL_RECORD(CSAND_GL_UNIFORM1I, location, v0);
+}
+
+void glUniform2i(GLint location, GLint v0, GLint v1) {
+    CSAND_GL_RECORD(CSAND_GL_UNIFORM2I, location, v0, v1);
+}
+
+void glUniform2f(GLint location, GLfloat v0, GLfloat v1) {
+    CSAND_GL_RECORD(CSAND_GL_UNIFORM2F, location, csandGlFloatBits(v0), csandGlFloatBits(v1));
+}
+
+void glScissor(GLint x, GLint y, GLsizei width, GLsizei height) {
+    CSAND_GL_RECORD(CSAND_GL_SCISSOR, x, y, width, height);
+}
+
+void glTexImage2D(GLenum target, GLint level, GLint internalformat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void *pixels) {
+    uint32_t args[] = {target, level, internalformat, width, height, border, format, type, csandGlPointerBits(pixels)};
+    csandGlRecord(CSAND_GL_TEX_IMAGE_2D, args, 9, 8, pixels, csandGlImageSize(width, height, format, type));
+}
+
+void glTexSubImage2D(GLenum target, GLint level, GLint xoffset, GLint yoffset, GLsizei width, GLsizei height, GLenum format, GLenum type, const void *pixels) {
+    uint32_t args[] = {target, level, xoffset, yoffset, width, height, format, type, csandGlPointerBits(pixels)};
+    csandGlRecord(CSAND_GL_TEX_SUB_IMAGE_2D, args, 9, 8, pixels, csandGlImageSize(width, height, format, type));
+}
+
+void glBindFramebuffer(GLenum target, GLuint framebuffer) {
+    CSAND_GL_RECORD(CSAND_GL_BIND_FRAMEBUFFER, target, framebuffer);
+}
+
+void glFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) {
+    CSAND_GL_RECORD(CSAND_GL_FRAMEBUFFER_TEXTURE_2D, target, attachment, textarget, texture, level);
+}
+
+void glBindVertexArrayOES(GLuint array) {
+    CSAND_GL_RECORD(CSAND_GL_BIND_VERTEX_ARRAY_OES, array);
+}
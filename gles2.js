@@ -4,7 +4,9 @@ import {
     setNullTerminatedString,
     setUint32Le,
     setInt32Le,
-    Uint32LeArray
+    Uint32LeArray,
+    HeapViews,
+    allocation_counter
 } from "./memutils.js";
 
 class HandlePool {
@@ -24,9 +26,20 @@ class HandlePool {
     }
 }
 
+function u32(data, args, i) {
+    return data.getUint32(args + i * 4, true);
+}
+
+function i32(data, args, i) {
+    return data.getInt32(args + i * 4, true);
+}
+
+function f32(data, args, i) {
+    return data.getFloat32(args + i * 4, true);
+}
+
 export class GLES2Context {
     gl;
-    memory;
     static #api = {
         glBlendEquation(mode) {
             this.gl.blendEquation(mode);
@@ -77,11 +90,24 @@ export class GLES2Context {
                 return;
             }
 
-            this.gl.bufferData(target, this.memory.buffer.slice(data_ptr, data_ptr + size), usage);
+            // a length of 0 would mean the rest of the memory to WebGL 2
+            if (this.#isWebGL2() && size !== 0) {
+                this.gl.bufferData(target, this.#heap.bytes, usage, data_ptr, size);
+            } else {
+                this.gl.bufferData(target, this.#heapSubarray(data_ptr, size), usage);
+            }
         },
 
         glBufferSubData(target, offset, size, data_ptr) {
-            this.gl.bufferSubData(target, offset, this.memory.buffer.slice(data_ptr, data_ptr + size));
+            if (this.#isWebGL2() && size !== 0) {
+                this.gl.bufferSubData(target, offset, this.#heap.bytes, data_ptr, size);
+            } else {
+                this.gl.bufferSubData(target, offset, this.#heapSubarray(data_ptr, size));
+            }
+        },
+
+        glBindAttribLocation(program_handle, index, name_ptr) {
+            this.gl.bindAttribLocation(this.#programs.derefHandle(program_handle), index, getNullTerminatedString(this.memory.buffer, name_ptr));
         },
 
         glGetAttribLocation(program_handle, name_ptr) {
@@ -208,34 +234,35 @@ export class GLES2Context {
             this.gl.texParameteri(target, pname, param);
         },
 
+        glPixelStorei(pname, param) {
+            this.gl.pixelStorei(pname, param);
+        },
+
+        // locations are handles to the WebGLUniformLocation objects, which belong to the program they came from
         glGetUniformLocation(program_handle, name_ptr) {
             const program = this.#programs.derefHandle(program_handle);
-            const name = getNullTerminatedString(this.memory.buffer, name_ptr);
-
-            const active_uniforms_count = this.gl.getProgramParameter(program, this.gl.ACTIVE_UNIFORMS);
-            for (let i = 0; i < active_uniforms_count; i++) {
-                const uniform = this.gl.getActiveUniform(program, i);
-                if (uniform.name === name) {
-                    return i;
-                }
+            const location = this.gl.getUniformLocation(program, getNullTerminatedString(this.memory.buffer, name_ptr));
+            if (location === null) {
+                return -1;
             }
 
-            return -1;
+            return this.#uniform_locations.allocHandle(location);
         },
 
-        glUniform1i(location_index, value) {
-            const program = this.gl.getParameter(this.gl.CURRENT_PROGRAM);
-            this.gl.uniform1i(this.#getUniformLocationByIndex(program, location_index), value);
+        glUniform1i(location, value) {
+            this.gl.uniform1i(this.#derefUniformLocation(location), value);
         },
 
-        glUniform2i(location_index, v0, v1) {
-            const program = this.gl.getParameter(this.gl.CURRENT_PROGRAM);
-            this.gl.uniform2i(this.#getUniformLocationByIndex(program, location_index), v0, v1);
+        glUniform2i(location, v0, v1) {
+            this.gl.uniform2i(this.#derefUniformLocation(location), v0, v1);
         },
 
-        glUniform2f(location_index, v0, v1) {
-            const program = this.gl.getParameter(this.gl.CURRENT_PROGRAM);
-            this.gl.uniform2f(this.#getUniformLocationByIndex(program, location_index), v0, v1);
+        glUniform2f(location, v0, v1) {
+            this.gl.uniform2f(this.#derefUniformLocation(location), v0, v1);
+        },
+
+        glFinish() {
+            this.gl.finish();
         },
 
         glScissor(x, y, width, height) {
@@ -243,11 +270,22 @@ export class GLES2Context {
         },
 
         glTexImage2D(target, level, internal_format, width, height, border, format, type, pixels_ptr) {
+            if (pixels_ptr !== 0 && type === this.gl.UNSIGNED_BYTE && this.#isWebGL2()) {
+                this.gl.texImage2D(target, level, internal_format, width, height, border, format, type, this.#heap.bytes, pixels_ptr);
+                return;
+            }
+
             let pixels = this.#pixelsFromMemory(width, height, format, type, pixels_ptr);
             this.gl.texImage2D(target, level, internal_format, width, height, border, format, type, pixels);
         },
 
+        // the world gets uploaded through here every frame, so the WebGL 2 path reads straight from the cached view
         glTexSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels_ptr) {
+            if (pixels_ptr !== 0 && type === this.gl.UNSIGNED_BYTE && this.#isWebGL2()) {
+                this.gl.texSubImage2D(target, level, xoffset, yoffset, width, height, format, type, this.#heap.bytes, pixels_ptr);
+                return;
+            }
+
             let pixels = this.#pixelsFromMemory(width, height, format, type, pixels_ptr);
             this.gl.texSubImage2D(target, level, xoffset, yoffset, width, height, format, type, pixels);
         },
@@ -271,6 +309,41 @@ export class GLES2Context {
         glFramebufferTexture2D(target, attachment, textarget, texture_handle, level) {
             this.gl.framebufferTexture2D(target, attachment, textarget, this.#textures.derefHandle(texture_handle), level);
         },
+
+        glCheckFramebufferStatus(target) {
+            return this.gl.checkFramebufferStatus(target);
+        },
+
+        // WebGL only reads RGBA unsigned bytes, which is all the gpu simulation asks for
+        glReadPixels(x, y, width, height, format, type, pixels_ptr) {
+            if (this.#isWebGL2()) {
+                this.gl.readPixels(x, y, width, height, format, type, this.#heap.bytes, pixels_ptr);
+                return;
+            }
+
+            this.gl.readPixels(x, y, width, height, format, type, this.#heapSubarray(pixels_ptr, width * height * 4));
+        },
+
+        // only called when extensionSupported said yes, WebGL 2 has vertex arrays built in
+        glGenVertexArraysOES(n, arrays_ptr) {
+            if (n < 0) {
+                return; // TODO: should generate GL_INVALID_VALUE
+            }
+            const arrays = new Uint32LeArray(this.memory.buffer, arrays_ptr, n);
+            for (let i = 0; i < n; i++) {
+                const vertex_array = this.#isWebGL2() ? this.gl.createVertexArray() : this.#vertexArrayExtension().createVertexArrayOES();
+                arrays.set(i, this.#vertex_arrays.allocHandle(vertex_array));
+            }
+        },
+
+        glBindVertexArrayOES(array_handle) {
+            const vertex_array = this.#vertex_arrays.derefHandle(array_handle);
+            if (this.#isWebGL2()) {
+                this.gl.bindVertexArray(vertex_array);
+            } else {
+                this.#vertexArrayExtension().bindVertexArrayOES(vertex_array);
+            }
+        },
     };
 
     #buffers = new HandlePool();
@@ -278,26 +351,125 @@ export class GLES2Context {
     #programs = new HandlePool();
     #textures = new HandlePool();
     #framebuffers = new HandlePool();
+    #uniform_locations = new HandlePool();
+    #vertex_arrays = new HandlePool();
+    #vertex_array_extension = null;
+    #heap = new HeapViews(null);
+    #command_buffer_ptr = 0;
+
+    /* Replayers for the calls gl_commands.c batches, indexed by CsandGlOpcode.
+     * Each gets the address of its first argument. */
+    static #commands = [
+        function (d, a) { GLES2Context.#api.glBlendEquation.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glBlendFunc.call(this, u32(d, a, 0), u32(d, a, 1)); },
+        function (d, a) { GLES2Context.#api.glEnable.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glDisable.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glViewport.call(this, i32(d, a, 0), i32(d, a, 1), i32(d, a, 2), i32(d, a, 3)); },
+        function (d, a) { GLES2Context.#api.glClearColor.call(this, f32(d, a, 0), f32(d, a, 1), f32(d, a, 2), f32(d, a, 3)); },
+        function (d, a) { GLES2Context.#api.glClear.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glBindBuffer.call(this, u32(d, a, 0), u32(d, a, 1)); },
+        function (d, a) { GLES2Context.#api.glBufferData.call(this, u32(d, a, 0), i32(d, a, 1), u32(d, a, 2), u32(d, a, 3)); },
+        function (d, a) { GLES2Context.#api.glBufferSubData.call(this, u32(d, a, 0), i32(d, a, 1), i32(d, a, 2), u32(d, a, 3)); },
+        function (d, a) { GLES2Context.#api.glVertexAttribPointer.call(this, u32(d, a, 0), i32(d, a, 1), u32(d, a, 2), u32(d, a, 3) !== 0, i32(d, a, 4), u32(d, a, 5)); },
+        function (d, a) { GLES2Context.#api.glEnableVertexAttribArray.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glUseProgram.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glDrawArrays.call(this, u32(d, a, 0), i32(d, a, 1), i32(d, a, 2)); },
+        function (d, a) { GLES2Context.#api.glDrawElements.call(this, u32(d, a, 0), i32(d, a, 1), u32(d, a, 2), u32(d, a, 3)); },
+        function (d, a) { GLES2Context.#api.glActiveTexture.call(this, u32(d, a, 0)); },
+        function (d, a) { GLES2Context.#api.glBindTexture.call(this, u32(d, a, 0), u32(d, a, 1)); },
+        function (d, a) { GLES2Context.#api.glTexParameteri.call(this, u32(d, a, 0), u32(d, a, 1), i32(d, a, 2)); },
+        function (d, a) { GLES2Context.#api.glPixelStorei.call(this, u32(d, a, 0), i32(d, a, 1)); },
+        function (d, a) { GLES2Context.#api.glUniform1i.call(this, i32(d, a, 0), i32(d, a, 1)); },
+        function (d, a) { GLES2Context.#api.glUniform2i.call(this, i32(d, a, 0), i32(d, a, 1), i32(d, a, 2)); },
+        function (d, a) { GLES2Context.#api.glUniform2f.call(this, i32(d, a, 0), f32(d, a, 1), f32(d, a, 2)); },
+        function (d, a) { GLES2Context.#api.glScissor.call(this, i32(d, a, 0), i32(d, a, 1), i32(d, a, 2), i32(d, a, 3)); },
+        function (d, a) { GLES2Context.#api.glTexImage2D.call(this, u32(d, a, 0), i32(d, a, 1), i32(d, a, 2), i32(d, a, 3), i32(d, a, 4), i32(d, a, 5), u32(d, a, 6), u32(d, a, 7), u32(d, a, 8)); },
+        function (d, a) { GLES2Context.#api.glTexSubImage2D.call(this, u32(d, a, 0), i32(d, a, 1), i32(d, a, 2), i32(d, a, 3), i32(d, a, 4), i32(d, a, 5), u32(d, a, 6), u32(d, a, 7), u32(d, a, 8)); },
+        function (d, a) { GLES2Context.#api.glBindFramebuffer.call(this, u32(d, a, 0), u32(d, a, 1)); },
+        function (d, a) { GLES2Context.#api.glFramebufferTexture2D.call(this, u32(d, a, 0), u32(d, a, 1), u32(d, a, 2), u32(d, a, 3), i32(d, a, 4)); },
+        function (d, a) { GLES2Context.#api.glBindVertexArrayOES.call(this, u32(d, a, 0)); },
+    ];
 
     constructor(gl, memory) {
         this.gl = gl;
         this.memory = memory;
     }
 
+    get memory() {
+        return this.#heap.memory;
+    }
+
+    set memory(memory) {
+        this.#heap.memory = memory;
+    }
+
+    #isWebGL2() {
+        return typeof WebGL2RenderingContext !== "undefined" && this.gl instanceof WebGL2RenderingContext;
+    }
+
+    // WebGL 1 has no source offsets, so it needs a view of its own
+    #heapSubarray(ptr, size) {
+        allocation_counter.addView();
+        return this.#heap.bytes.subarray(ptr, ptr + size);
+    }
+
     importIntoObject(object) {
+        const context = this;
         for (const key in GLES2Context.#api) {
-            object[key] = GLES2Context.#api[key].bind(this);
+            const f = GLES2Context.#api[key];
+            // whatever isn't batched may depend on the batched calls before it
+            object[key] = function () {
+                context.flushCommands();
+                return f.apply(context, arguments);
+            };
         }
+
+        object.csandGlSetCommandBuffer = (ptr) => {
+            this.#command_buffer_ptr = ptr;
+        };
+        object.csandGlFlushCommands = () => {
+            this.flushCommands();
+        };
     }
 
-    #getUniformLocationByIndex(program, index) {
-        // TODO: probably should cache this.
-        const active_uniform = this.gl.getActiveUniform(program, index);
-        if (active_uniform === null) {
-            return null;
+    // replays everything gl_commands.c recorded so far
+    flushCommands() {
+        const ptr = this.#command_buffer_ptr;
+        if (ptr === 0) {
+            return;
+        }
+
+        const data = this.#heap.data;
+        const length = data.getUint32(ptr, true);
+        const end = ptr + 4 + length * 4;
+        for (let command = ptr + 4; command < end;) {
+            const header = data.getUint32(command, true);
+            GLES2Context.#commands[header & 0xFF].call(this, data, command + 4);
+            command += (header >>> 8) * 4;
+        }
+
+        data.setUint32(ptr, 0, true);
+    }
+
+    #derefUniformLocation(location) {
+        return location < 0 ? null : this.#uniform_locations.derefHandle(location);
+    }
+
+    #vertexArrayExtension() {
+        if (this.#vertex_array_extension === null) {
+            this.#vertex_array_extension = this.gl.getExtension("OES_vertex_array_object");
+        }
+
+        return this.#vertex_array_extension;
+    }
+
+    // takes GLES names like "GL_OES_vertex_array_object"
+    extensionSupported(name) {
+        if (name === "GL_OES_vertex_array_object" && this.#isWebGL2()) {
+            return true;
         }
 
-        return this.gl.getUniformLocation(program, active_uniform.name);
+        return name.startsWith("GL_") && this.gl.getExtension(name.slice(3)) !== null;
     }
 
     #getChannelsCountFromFormat(format) {
@@ -323,7 +495,7 @@ export class GLES2Context {
         if (pixels_ptr === 0) {
             return null;
         } else if (type === this.gl.UNSIGNED_BYTE) {
-            return new Uint8Array(this.memory.buffer, pixels_ptr, width * height * channels);
+            return this.#heapSubarray(pixels_ptr, width * height * channels);
         } else if (type === this.gl.UNSIGNED_SHORT_5_6_5 || type === UNSIGNED_SHORT_4_4_4_4 || type === UNSIGNED_SHORT_5_5_5_1) {
             throw new Error("not implemented");
         }
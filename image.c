@@ -0,0 +1,168 @@
+#include "image.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CSAND_DEFLATE_MAX_STORED_BLOCK 65535
+
+typedef struct CsandPngWriter {
+    FILE *file;
+    uint32_t crc;
+    uint32_t adler_a;
+    uint32_t adler_b;
+    // raw bytes of the image data not yet put in a stored block
+    size_t block_fill;
+    size_t raw_remaining;
+    unsigned char block[CSAND_DEFLATE_MAX_STORED_BLOCK];
+} CsandPngWriter;
+
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static void csandPutU32Be(unsigned char *out, uint32_t value) {
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+static void csandPngWrite(CsandPngWriter *writer, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    uint32_t crc = writer->crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    writer->crc = crc;
+    fwrite(data, 1, size, writer->file);
+}
+
+static void csandPngBeginChunk(CsandPngWriter *writer, const char *type, uint32_t length) {
+    unsigned char length_bytes[4];
+    csandPutU32Be(length_bytes, length);
+    fwrite(length_bytes, 1, sizeof(length_bytes), writer->file);
+
+    writer->crc = 0xFFFFFFFF;
+    csandPngWrite(writer, type, 4);
+}
+
+static void csandPngEndChunk(CsandPngWriter *writer) {
+    unsigned char crc_bytes[4];
+    csandPutU32Be(crc_bytes, ~writer->crc);
+    fwrite(crc_bytes, 1, sizeof(crc_bytes), writer->file);
+}
+
+static void csandPngFlushBlock(CsandPngWriter *writer) {
+    bool final = writer->raw_remaining == 0;
+    uint16_t length = writer->block_fill;
+    unsigned char header[5] = {final, length, length >> 8, ~length, (uint16_t)~length >> 8};
+    csandPngWrite(writer, header, sizeof(header));
+    csandPngWrite(writer, writer->block, writer->block_fill);
+    writer->block_fill = 0;
+}
+
+// feeds the zlib stream, which holds the image data in stored deflate blocks
+static void csandPngWriteRaw(CsandPngWriter *writer, const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        writer->adler_a = (writer->adler_a + data[i]) % 65521;
+        writer->adler_b = (writer->adler_b + writer->adler_a) % 65521;
+    }
+
+    while (size > 0) {
+        size_t count = CSAND_DEFLATE_MAX_STORED_BLOCK - writer->block_fill;
+        if (count > size) {
+            count = size;
+        }
+
+        memcpy(writer->block + writer->block_fill, data, count);
+        writer->block_fill += count;
+        writer->raw_remaining -= count;
+        data += count;
+        size -= count;
+
+        if (writer->block_fill == CSAND_DEFLATE_MAX_STORED_BLOCK || writer->raw_remaining == 0) {
+            csandPngFlushBlock(writer);
+        }
+    }
+}
+
+static bool csandWritePng(FILE *file, unsigned int width, unsigned int height, const unsigned char *rgb) {
+    if (!crc_table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+            }
+            crc_table[i] = crc;
+        }
+        crc_table_ready = true;
+    }
+
+    // every row starts with its filter type, always none here
+    size_t row_size = (size_t)width * 3;
+    size_t raw_size = (row_size + 1) * height;
+    size_t blocks_count = (raw_size + CSAND_DEFLATE_MAX_STORED_BLOCK - 1) / CSAND_DEFLATE_MAX_STORED_BLOCK;
+    size_t idat_size = 2 + blocks_count * 5 + raw_size + 4;
+    if (idat_size > UINT32_MAX / 2) {
+        return false;
+    }
+
+    static CsandPngWriter writer;
+    writer = (CsandPngWriter){.file = file, .adler_a = 1, .raw_remaining = raw_size};
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    fwrite(signature, 1, sizeof(signature), file);
+
+    // 8 bits per channel, truecolor, no interlacing
+    unsigned char ihdr[13] = {0};
+    csandPutU32Be(ihdr, width);
+    csandPutU32Be(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+    csandPngBeginChunk(&writer, "IHDR", sizeof(ihdr));
+    csandPngWrite(&writer, ihdr, sizeof(ihdr));
+    csandPngEndChunk(&writer);
+
+    csandPngBeginChunk(&writer, "IDAT", idat_size);
+    static const unsigned char zlib_header[2] = {0x78, 0x01};
+    csandPngWrite(&writer, zlib_header, sizeof(zlib_header));
+    for (unsigned int y = 0; y < height; y++) {
+        static const unsigned char filter = 0;
+        csandPngWriteRaw(&writer, &filter, 1);
+        csandPngWriteRaw(&writer, rgb + y * row_size, row_size);
+    }
+    unsigned char adler[4];
+    csandPutU32Be(adler, writer.adler_b << 16 | writer.adler_a);
+    csandPngWrite(&writer, adler, sizeof(adler));
+    csandPngEndChunk(&writer);
+
+    csandPngBeginChunk(&writer, "IEND", 0);
+    csandPngEndChunk(&writer);
+    return true;
+}
+
+bool csandWriteImage(const char *path, unsigned int width, unsigned int height, const unsigned char *rgb) {
+    if (width == 0 || height == 0) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    size_t path_length = strlen(path);
+    bool png = path_length >= 4 && strcmp(path + path_length - 4, ".png") == 0;
+
+    bool ok;
+    if (png) {
+        ok = csandWritePng(file, width, height, rgb);
+    } else {
+        fprintf(file, "P6\n%u %u\n255\n", width, height);
+        ok = fwrite(rgb, 3, (size_t)width * height, file) == (size_t)width * height;
+    }
+
+    ok = !ferror(file) && ok;
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,11 @@
+#ifndef CSAND_IMAGE_H
+#define CSAND_IMAGE_H
+
+#include <stdbool.h>
+
+/* Writes 8-bit RGB pixels, rows top to bottom, as a PNG when the path ends
+ * in ".png" and as a binary PPM otherwise. The PNG isn't compressed, so
+ * nothing beyond libc is needed. */
+bool csandWriteImage(const char *path, unsigned int width, unsigned int height, const unsigned char *rgb);
+
+#endif
@@ -1,5 +1,5 @@
 import { GLES2Context } from "./gles2.js";
-import { getNullTerminatedString, Uint16LeArray } from "./memutils.js";
+import { getNullTerminatedString, HeapViews, allocation_counter } from "./memutils.js";
 
 let function_table = null;
 let input_callback = null;
@@ -18,8 +18,23 @@ let captured_pointer_id = null;
 let mouse_x = 0;
 let mouse_y = 0;
 let scratch_buf_ptr = 0;
+let memory = null;
+let idle = false;
+let events_received = false;
+const heap = new HeapViews(null);
 const gles2_context = new GLES2Context(null, null);
 
+/* The threaded build runs the simulation in a worker on shared memory, which
+ * browsers only allow on cross-origin isolated pages, so the server has to
+ * send "Cross-Origin-Opener-Policy: same-origin" and
+ * "Cross-Origin-Embedder-Policy: require-corp". */
+const threaded = typeof SharedArrayBuffer !== "undefined" && self.crossOriginIsolated;
+const wasm_page_size = 64 * 1024;
+// must match --initial-memory and --max-memory of csand_threads.wasm in the Makefile
+const threads_initial_pages = 16 * 1024 * 1024 / wasm_page_size;
+const threads_max_pages = 1024 * 1024 * 1024 / wasm_page_size;
+const simulation_thread_stack_pages = 16;
+
 async function main() {
     const import_object = {
         env: {
@@ -48,31 +63,60 @@ async function main() {
             csandPlatformRun: () => {
                 requestAnimationFrame(csandPlatformRun);
             },
+            csandPlatformSetIdle: (value) => {
+                idle = value !== 0;
+            },
             csandPlatformIsMouseButtonPressed: () => {return mouse_down;},
             csandPlatformGetCursorPos: (vec_ptr) => {
-                const vec = new Uint16LeArray(obj.instance.exports.memory.buffer, vec_ptr, 2);
-                vec.set(0, mouse_x);
-                vec.set(1, mouse_y);
+                heap.data.setUint16(vec_ptr, mouse_x, true);
+                heap.data.setUint16(vec_ptr + 2, mouse_y, true);
             },
             csandPlatformGetWindowSize: csandPlatformGetWindowSize,
             csandPlatformGetFramebufferSize: csandPlatformGetWindowSize,
             csandPlatformPrintErr: (str_ptr) => {
-                console.error(getNullTerminatedString(obj.instance.exports.memory.buffer, str_ptr));
+                console.error(getNullTerminatedString(memory.buffer, str_ptr));
+            },
+            csandPlatformGetTime: () => {
+                return performance.now() / 1000.0;
             },
             csandPlatformToggleFullscreen: () => {
                 toggleFullscreen();
             },
+            csandPlatformGlExtensionSupported: (name_ptr) => {
+                return gles2_context.extensionSupported(getNullTerminatedString(memory.buffer, name_ptr));
+            },
+            csandPlatformGetFrameGlueAllocations: () => {
+                return allocation_counter.last_frame_bytes;
+            },
         }
     };
 
     gles2_context.importIntoObject(import_object.env);
-    obj = await WebAssembly.instantiateStreaming(fetch("csand.wasm"), import_object);
-    gles2_context.memory = obj.instance.exports.memory;
+    if (threaded) {
+        memory = new WebAssembly.Memory({initial: threads_initial_pages, maximum: threads_max_pages, shared: true});
+        import_object.env.memory = memory;
+        obj = await WebAssembly.instantiateStreaming(fetch("csand_threads.wasm"), import_object);
+    } else {
+        obj = await WebAssembly.instantiateStreaming(fetch("csand.wasm"), import_object);
+        memory = obj.instance.exports.memory;
+    }
+    gles2_context.memory = memory;
+    heap.memory = memory;
 
     function_table = obj.instance.exports.__indirect_function_table;
-    const wasm_page_size = 64 * 1024;
-    scratch_buf_ptr = obj.instance.exports.memory.grow(1) * wasm_page_size;
+    scratch_buf_ptr = memory.grow(1) * wasm_page_size;
     obj.instance.exports.main();
+
+    if (threaded) {
+        startSimulationThread();
+    }
+}
+
+function startSimulationThread() {
+    // pages grown here are never touched by the heap, so they can serve as the stack
+    const stack_top = (memory.grow(simulation_thread_stack_pages) + simulation_thread_stack_pages) * wasm_page_size;
+    const worker = new Worker("simulation_worker.js", {type: "module"});
+    worker.postMessage({module: obj.module, memory: memory, stack_top: stack_top});
 }
 
 function resizeCanvas(width, height) {
@@ -89,7 +133,8 @@ function csandPlatformInit() {
     canvas = document.getElementById("canvas");
     resizeCanvas(window.innerWidth, window.innerHeight);
 
-    gl = canvas.getContext("webgl");
+    // WebGL 2 can upload from an offset into the memory, without a new view every call
+    gl = canvas.getContext("webgl2") ?? canvas.getContext("webgl");
     gles2_context.gl = gl;
 
     function sendKey(event, pressed) {
@@ -186,6 +231,16 @@ function csandPlatformInit() {
     window.addEventListener("resize", (event) => {
         resizeCanvas(window.innerWidth, window.innerHeight);
     });
+
+    // an idle page only renders again after one of these
+    for (const type of ["keydown", "keyup", "wheel", "pointerdown", "pointerup", "pointercancel", "pointermove"]) {
+        document.addEventListener(type, () => {
+            events_received = true;
+        });
+    }
+    window.addEventListener("resize", () => {
+        events_received = true;
+    });
 }
 
 function clamp(x, min, max) {
@@ -216,18 +271,26 @@ function toggleFullscreen() {
 }
 
 function csandPlatformRun(time) {
+    // the canvas keeps showing the last frame while nothing gets drawn
+    if (idle && !events_received) {
+        requestAnimationFrame(csandPlatformRun);
+        return;
+    }
+    events_received = false;
+
+    allocation_counter.endFrame();
+
     if (render_callback != null) {
         render_callback(time / 1000.0);
     }
+    gles2_context.flushCommands();
 
     requestAnimationFrame(csandPlatformRun);
 }
 
 function csandPlatformGetWindowSize(vec_ptr) {
-    const vec = new Uint16LeArray(obj.instance.exports.memory.buffer, vec_ptr, 2);
-
-    vec.set(0, canvas.width);
-    vec.set(1, canvas.height);
+    heap.data.setUint16(vec_ptr, canvas.width, true);
+    heap.data.setUint16(vec_ptr + 2, canvas.height, true);
 }
 
 main();
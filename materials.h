@@ -0,0 +1,24 @@
+#ifndef CSAND_MATERIALS_H
+#define CSAND_MATERIALS_H
+
+// their properties live in csand.c, this is for anything else that has to name them
+enum {
+    MAT_AIR,
+    MAT_WALL,
+    MAT_SAND,
+    MAT_WATER,
+    MAT_FIRE_GAS,
+    MAT_FIRE_POWDER,
+    MAT_FIRE_LIQUID,
+    MAT_SMOKE,
+    MAT_WOOD,
+    MAT_COAL,
+    MAT_OIL,
+    MAT_HYDROGEN_GAS,
+    MAT_HYDROGEN_LIQUID,
+    MAT_UPDATED_BIT = 0x80
+};
+
+#define MATERIALS_COUNT MAT_UPDATED_BIT
+
+#endif
@@ -19,9 +19,15 @@
         return a <= b ? a : b; \
     }
 
+#define CSAND_GEN_MAX(type, name) \
+    static inline type csand##name##Max(type a, type b) { \
+        return a >= b ? a : b; \
+    }
+
 #define CSAND_GEN_MATH(type, name) \
     CSAND_GEN_CLAMP(type, name) \
-    CSAND_GEN_MIN(type, name)
+    CSAND_GEN_MIN(type, name) \
+    CSAND_GEN_MAX(type, name)
 
 CSAND_X_TYPES(CSAND_GEN_MATH)
 
@@ -1,8 +1,27 @@
 const utf8_decoder = new TextDecoder("utf-8");
 const utf8_encoder = new TextEncoder("utf-8");
 
+// a rough guess, engines don't tell how big their typed array and DataView objects are
+const view_object_size = 64;
+
+// Counts what the JS glue allocates, to catch garbage made every frame.
+export const allocation_counter = {
+    bytes: 0,
+    last_frame_bytes: 0,
+
+    addView() {
+        this.bytes += view_object_size;
+    },
+
+    endFrame() {
+        this.last_frame_bytes = this.bytes;
+        this.bytes = 0;
+    },
+};
+
 export function strlen(buffer, ptr) {
     const view = new DataView(buffer);
+    allocation_counter.addView();
     let i = 0;
     while (view.getUint8(ptr + i) != 0) {
         i++;
@@ -11,7 +30,10 @@ export function strlen(buffer, ptr) {
 }
 
 export function getString(buffer, ptr, len) {
-    return utf8_decoder.decode(buffer.slice(ptr, ptr + len));
+    // copied through a typed array, TextDecoder refuses views of a SharedArrayBuffer
+    allocation_counter.addView();
+    allocation_counter.bytes += 2 * len;
+    return utf8_decoder.decode(new Uint8Array(buffer, ptr, len).slice());
 }
 
 export function getNullTerminatedString(buffer, ptr) {
@@ -27,6 +49,7 @@ export function setNullTerminatedString(buffer, ptr, max_len, str) {
     }
 
     const array = new Uint8Array(buffer, ptr, max_len - 1);
+    allocation_counter.addView();
     const result = utf8_encoder.encodeInto(str, array);
     array[result.written] = 0;
     return result.written;
@@ -34,14 +57,53 @@ export function setNullTerminatedString(buffer, ptr, max_len, str) {
 
 export function setUint32Le(buffer, ptr, value) {
     const view = new DataView(buffer);
+    allocation_counter.addView();
     view.setUint32(ptr, value, true);
 }
 
 export function setInt32Le(buffer, ptr, value) {
     const view = new DataView(buffer);
+    allocation_counter.addView();
     view.setInt32(ptr, value, true);
 }
 
+/* Views over all of a wasm memory, made once and only made again after the
+ * memory grew, so that reading and writing it doesn't allocate. */
+export class HeapViews {
+    memory;
+    #buffer = null;
+    #bytes = null;
+    #data = null;
+
+    constructor(memory) {
+        this.memory = memory;
+    }
+
+    get bytes() {
+        this.#refresh();
+        return this.#bytes;
+    }
+
+    get data() {
+        this.#refresh();
+        return this.#data;
+    }
+
+    #refresh() {
+        // growing detaches an unshared buffer, while a shared one gets a new, longer object
+        const buffer = this.memory.buffer;
+        if (buffer === this.#buffer && buffer.byteLength === this.#bytes.length) {
+            return;
+        }
+
+        this.#buffer = buffer;
+        this.#bytes = new Uint8Array(buffer);
+        this.#data = new DataView(buffer);
+        allocation_counter.addView();
+        allocation_counter.addView();
+    }
+}
+
 const uint16_size = 2;
 export class Uint16LeArray {
     #view;
@@ -56,6 +118,7 @@ export class Uint16LeArray {
 
     constructor(buffer, ptr, len) {
         this.#view = new DataView(buffer, ptr, len * uint16_size);
+        allocation_counter.addView();
     }
 }
 
@@ -73,5 +136,6 @@ export class Uint32LeArray {
 
     constructor(buffer, ptr, len) {
         this.#view = new DataView(buffer, ptr, len * uint32_size);
+        allocation_counter.addView();
     }
 }
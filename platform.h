@@ -3,6 +3,7 @@
 
 #include "vec2.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
@@ -155,6 +156,7 @@ typedef void (*CsandMouseButtonCallback)(CsandMouseButton button, unsigned int p
 typedef void (*CsandMouseMotionCallback)(double x, double y);
 typedef void (*CsandMouseScrollCallback)(double x, double y);
 typedef void (*CsandFramebufferSizeCallback)(CsandVec2Us size);
+typedef void (*CsandGlProc)(void);
 
 void csandPlatformInit(void);
 void csandPlatformSetRenderCallback(CsandRenderCallback callback);
@@ -169,7 +171,17 @@ CsandVec2Us csandPlatformGetCursorPos(void);
 CsandVec2Us csandPlatformGetWindowSize(void);
 CsandVec2Us csandPlatformGetFramebufferSize(void);
 void csandPlatformRun(void);
+// while idle, frames are only rendered after input or anything else that may change what's on screen
+void csandPlatformSetIdle(bool idle);
 void csandPlatformPrintErr(const char *str);
+// in seconds, from a monotonic clock with an unspecified start
+double csandPlatformGetTime(void);
 void csandPlatformToggleFullscreen(void);
+// both need the GL context, which csandPlatformInit creates
+bool csandPlatformGlExtensionSupported(const char *name);
+// not in the web build, gles2.js provides the extension functions there
+CsandGlProc csandPlatformGetGlProc(const char *name);
+// bytes the JS glue allocated during the last frame, always 0 where there's no glue
+size_t csandPlatformGetFrameGlueAllocations(void);
 
 #endif
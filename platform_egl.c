@@ -0,0 +1,318 @@
+/* Headless platform, renders into an EGL pbuffer with no window or display,
+ * which Mesa's llvmpipe can do on machines without a GPU. There's no input,
+ * every frame simply advances the simulation by one tick. Configured through
+ * the environment:
+ *   CSAND_HEADLESS_FRAMES  frames to render, 60 by default
+ *   CSAND_HEADLESS_WIDTH, CSAND_HEADLESS_HEIGHT  framebuffer size, 1024x512 by default
+ *   CSAND_HEADLESS_OUTPUT  where the frames go, a printf pattern taking the
+ *                          frame number as an unsigned int (frame%04u.png)
+ *                          writes all of them, a plain path only the last
+ *                          one, ".png" paths are PNGs, anything else PPM
+ * Once done, the time each render pass took is printed to stdout. */
+// for clock_gettime
+#define _POSIX_C_SOURCE 200809L
+#include "image.h"
+#include "platform.h"
+#include "renderer.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <float.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CSAND_HEADLESS_DEFAULT_FRAMES 60
+#define CSAND_HEADLESS_DEFAULT_WIDTH 1024
+#define CSAND_HEADLESS_DEFAULT_HEIGHT 512
+// the time handed to the render callback advances by this much per frame, so every frame runs a tick
+#define CSAND_HEADLESS_FRAME_TIME (1.0 / 60.0)
+#define CSAND_HEADLESS_MAX_PATH 4096
+
+typedef struct CsandPassStats {
+    double total;
+    double min;
+    double max;
+} CsandPassStats;
+
+typedef struct CsandPlatform {
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+    CsandVec2Us size;
+    CsandRenderCallback render_callback;
+    unsigned long frames;
+    const char *output;
+    unsigned char *pixels;
+} CsandPlatform;
+
+static CsandPlatform platform = {0};
+
+static unsigned long csandEnvUl(const char *name, unsigned long fallback, unsigned long max) {
+    const char *value = getenv(name);
+    if (value == NULL) {
+        return fallback;
+    }
+
+    char *end;
+    unsigned long result = strtoul(value, &end, 10);
+    if (end == value || *end != '\0' || result == 0 || result > max) {
+        fprintf(stderr, "ignoring %s=%s\n", name, value);
+        return fallback;
+    }
+
+    return result;
+}
+
+static void csandEglFail(const char *what) {
+    fprintf(stderr, "%s failed, egl error 0x%x\n", what, eglGetError());
+    exit(1);
+}
+
+// prefers Mesa's surfaceless platform, which doesn't need X or Wayland
+static EGLDisplay csandEglGetDisplay(void) {
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (client_extensions != NULL && strstr(client_extensions, "EGL_MESA_platform_surfaceless") && get_platform_display != NULL) {
+        EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY) {
+            return display;
+        }
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+void csandPlatformInit(void) {
+    platform.frames = csandEnvUl("CSAND_HEADLESS_FRAMES", CSAND_HEADLESS_DEFAULT_FRAMES, ULONG_MAX);
+    platform.size.x = csandEnvUl("CSAND_HEADLESS_WIDTH", CSAND_HEADLESS_DEFAULT_WIDTH, USHRT_MAX);
+    platform.size.y = csandEnvUl("CSAND_HEADLESS_HEIGHT", CSAND_HEADLESS_DEFAULT_HEIGHT, USHRT_MAX);
+    platform.output = getenv("CSAND_HEADLESS_OUTPUT");
+
+    platform.display = csandEglGetDisplay();
+    if (platform.display == EGL_NO_DISPLAY || !eglInitialize(platform.display, NULL, NULL)) {
+        csandEglFail("eglInitialize");
+    }
+
+    if (!eglBindAPI(EGL_OPENGL_ES_API)) {
+        csandEglFail("eglBindAPI");
+    }
+
+    static const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint configs_count;
+    if (!eglChooseConfig(platform.display, config_attribs, &config, 1, &configs_count) || configs_count == 0) {
+        csandEglFail("eglChooseConfig");
+    }
+
+    const EGLint surface_attribs[] = {
+        EGL_WIDTH, platform.size.x,
+        EGL_HEIGHT, platform.size.y,
+        EGL_NONE,
+    };
+    platform.surface = eglCreatePbufferSurface(platform.display, config, surface_attribs);
+    if (platform.surface == EGL_NO_SURFACE) {
+        csandEglFail("eglCreatePbufferSurface");
+    }
+
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE,
+    };
+    platform.context = eglCreateContext(platform.display, config, EGL_NO_CONTEXT, context_attribs);
+    if (platform.context == EGL_NO_CONTEXT) {
+        csandEglFail("eglCreateContext");
+    }
+
+    if (!eglMakeCurrent(platform.display, platform.surface, platform.surface, platform.context)) {
+        csandEglFail("eglMakeCurrent");
+    }
+}
+
+void csandPlatformSetRenderCallback(CsandRenderCallback callback) {
+    platform.render_callback = callback;
+}
+
+// there's no input, so none of these ever get called
+void csandPlatformSetKeyCallback(CsandKeyCallback callback) {
+    (void)callback;
+}
+
+void csandPlatformSetCharCallback(CsandCharCallback callback) {
+    (void)callback;
+}
+
+void csandPlatformSetMouseButtonCallback(CsandMouseButtonCallback callback) {
+    (void)callback;
+}
+
+void csandPlatformSetMouseMotionCallback(CsandMouseMotionCallback callback) {
+    (void)callback;
+}
+
+void csandPlatformSetMouseScrollCallback(CsandMouseScrollCallback callback) {
+    (void)callback;
+}
+
+// the pbuffer never changes size
+void csandPlatformSetFramebufferSizeCallback(CsandFramebufferSizeCallback callback) {
+    (void)callback;
+}
+
+unsigned int csandPlatformIsMouseButtonPressed(CsandMouseButton button) {
+    (void)button;
+    return 0;
+}
+
+CsandVec2Us csandPlatformGetCursorPos(void) {
+    return (CsandVec2Us){0, 0};
+}
+
+CsandVec2Us csandPlatformGetWindowSize(void) {
+    return platform.size;
+}
+
+CsandVec2Us csandPlatformGetFramebufferSize(void) {
+    return platform.size;
+}
+
+// flips the frame right side up and drops alpha
+static void csandWriteFrame(unsigned long frame) {
+    size_t width = platform.size.x;
+    size_t height = platform.size.y;
+    unsigned char *rgba = platform.pixels;
+    unsigned char *rgb = platform.pixels + width * height * 4;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+    for (size_t y = 0; y < height; y++) {
+        const unsigned char *src = rgba + (height - 1 - y) * width * 4;
+        unsigned char *dst = rgb + y * width * 3;
+        for (size_t x = 0; x < width; x++) {
+            dst[x * 3 + 0] = src[x * 4 + 0];
+            dst[x * 3 + 1] = src[x * 4 + 1];
+            dst[x * 3 + 2] = src[x * 4 + 2];
+        }
+    }
+
+    char path[CSAND_HEADLESS_MAX_PATH];
+    snprintf(path, sizeof(path), platform.output, (unsigned int)frame);
+    if (!csandWriteImage(path, width, height, rgb)) {
+        fprintf(stderr, "failed to write %s\n", path);
+    }
+}
+
+static void csandAddPassTime(CsandPassStats *stats, double time) {
+    stats->total += time;
+    stats->min = time < stats->min ? time : stats->min;
+    stats->max = time > stats->max ? time : stats->max;
+}
+
+static void csandPrintPassStats(const char *name, const CsandPassStats *stats) {
+    printf("%-8s %10.3f %10.3f %10.3f\n", name, stats->total / platform.frames * 1000, stats->min * 1000, stats->max * 1000);
+}
+
+void csandPlatformRun(void) {
+    bool every_frame = platform.output != NULL && strchr(platform.output, '%') != NULL;
+    if (platform.output != NULL) {
+        platform.pixels = malloc((size_t)platform.size.x * platform.size.y * (4 + 3));
+        if (platform.pixels == NULL) {
+            fprintf(stderr, "failed to allocate the frame readback buffer\n");
+            return;
+        }
+    }
+
+    CsandPassStats pass_stats[CSAND_RENDER_PASSES_COUNT];
+    CsandPassStats frame_stats = {0, DBL_MAX, 0};
+    for (int i = 0; i < CSAND_RENDER_PASSES_COUNT; i++) {
+        pass_stats[i] = frame_stats;
+    }
+
+    csandRendererSetPassTiming(true);
+    for (unsigned long frame = 0; frame < platform.frames; frame++) {
+        double start = csandPlatformGetTime();
+        if (platform.render_callback) {
+            platform.render_callback(frame * CSAND_HEADLESS_FRAME_TIME);
+        }
+        glFinish();
+        csandAddPassTime(&frame_stats, csandPlatformGetTime() - start);
+
+        for (int i = 0; i < CSAND_RENDER_PASSES_COUNT; i++) {
+            csandAddPassTime(&pass_stats[i], csandRendererGetPassTime(i));
+        }
+
+        if (platform.output != NULL && (every_frame || frame == platform.frames - 1)) {
+            csandWriteFrame(frame);
+        }
+
+        eglSwapBuffers(platform.display, platform.surface);
+    }
+
+    printf("%lu frames at %ux%u, %s\n", platform.frames, platform.size.x, platform.size.y, glGetString(GL_RENDERER));
+    printf("%-8s %10s %10s %10s\n", "pass", "mean ms", "min ms", "max ms");
+    for (int i = 0; i < CSAND_RENDER_PASSES_COUNT; i++) {
+        csandPrintPassStats(csandRendererPassName(i), &pass_stats[i]);
+    }
+    // includes the simulation and everything else the render callback does
+    csandPrintPassStats("frame", &frame_stats);
+
+    free(platform.pixels);
+    eglMakeCurrent(platform.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(platform.display, platform.context);
+    eglDestroySurface(platform.display, platform.surface);
+    eglTerminate(platform.display);
+}
+
+// every frame gets rendered, idle or not
+void csandPlatformSetIdle(bool idle) {
+    (void)idle;
+}
+
+void csandPlatformPrintErr(const char *str) {
+    fwrite(str, 1, strlen(str), stderr);
+}
+
+double csandPlatformGetTime(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void csandPlatformToggleFullscreen(void) {
+}
+
+bool csandPlatformGlExtensionSupported(const char *name) {
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    size_t length = strlen(name);
+
+    for (const char *found = extensions; found != NULL && (found = strstr(found, name)) != NULL; found += length) {
+        bool starts = found == extensions || found[-1] == ' ';
+        bool ends = found[length] == '\0' || found[length] == ' ';
+        if (starts && ends) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+CsandGlProc csandPlatformGetGlProc(const char *name) {
+    return (CsandGlProc)eglGetProcAddress(name);
+}
+
+size_t csandPlatformGetFrameGlueAllocations(void) {
+    return 0;
+}
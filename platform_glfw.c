@@ -6,6 +6,9 @@
 #include <stdio.h>
 #include <string.h>
 
+// in seconds, how long an idle csandPlatformRun blocks before checking whether the window should close
+#define CSAND_IDLE_WAIT_TIMEOUT 0.5
+
 typedef struct CsandPlatform {
     GLFWwindow *window;
     CsandRenderCallback render_callback;
@@ -17,6 +20,9 @@ typedef struct CsandPlatform {
     CsandFramebufferSizeCallback framebuffer_size_callback;
     CsandVec2I windowed_mode_pos;
     CsandVec2I windowed_mode_size;
+    bool idle;
+    // set by every event callback, so an idle loop knows there's a frame to render
+    bool events_received;
 } CsandPlatform;
 
 static CsandPlatform platform = {0};
@@ -66,6 +72,8 @@ static void csandGlfwKeyCallback(GLFWwindow *window, int key, int scancode, int
     (void)scancode;
     (void)mods;
 
+    platform.events_received = true;
+
     if (!platform.key_callback) {
         return;
     }
@@ -80,6 +88,9 @@ static void csandGlfwKeyCallback(GLFWwindow *window, int key, int scancode, int
 
 static void csandGlfwCharCallback(GLFWwindow *window, unsigned int codepoint) {
     (void)window;
+
+    platform.events_received = true;
+
     if (platform.char_callback) {
         platform.char_callback(codepoint);
     }
@@ -89,6 +100,8 @@ static void csandGlfwMouseButtonCallback(GLFWwindow *window, int button, int act
     (void)window;
     (void)mods;
 
+    platform.events_received = true;
+
     if (
         platform.mouse_button_callback &&
         (button == GLFW_MOUSE_BUTTON_LEFT || button == GLFW_MOUSE_BUTTON_RIGHT) &&
@@ -101,6 +114,8 @@ static void csandGlfwMouseButtonCallback(GLFWwindow *window, int button, int act
 static void csandGlfwCursorPosCallback(GLFWwindow *window, double x, double y) {
     (void)window;
 
+    platform.events_received = true;
+
     if (platform.mouse_motion_callback) {
         platform.mouse_motion_callback(x, y);
     }
@@ -109,14 +124,24 @@ static void csandGlfwCursorPosCallback(GLFWwindow *window, double x, double y) {
 static void csandGlfwScrollCallback(GLFWwindow *window, double x, double y) {
     (void)window;
 
+    platform.events_received = true;
+
     if (platform.mouse_scroll_callback) {
         platform.mouse_scroll_callback(x, y);
     }
 }
 
+// the window got uncovered or otherwise needs its contents drawn again
+static void csandGlfwWindowRefreshCallback(GLFWwindow *window) {
+    (void)window;
+    platform.events_received = true;
+}
+
 static void csandGlfwFramebufferSizeCallback(GLFWwindow *window, int width, int height) {
     (void)window;
 
+    platform.events_received = true;
+
     if (platform.framebuffer_size_callback) {
         platform.framebuffer_size_callback((CsandVec2Us){
             csandUiMin(width, USHRT_MAX),
@@ -150,6 +175,7 @@ void csandPlatformInit(void) {
     glfwSetCursorPosCallback(platform.window, csandGlfwCursorPosCallback);
     glfwSetScrollCallback(platform.window, csandGlfwScrollCallback);
     glfwSetFramebufferSizeCallback(platform.window, csandGlfwFramebufferSizeCallback);
+    glfwSetWindowRefreshCallback(platform.window, csandGlfwWindowRefreshCallback);
 }
 
 void csandPlatformSetRenderCallback(CsandRenderCallback callback) {
@@ -228,7 +254,15 @@ CsandVec2Us csandPlatformGetFramebufferSize(void) {
 
 void csandPlatformRun(void) {
     while (!glfwWindowShouldClose(platform.window)) {
-        glfwPollEvents();
+        if (platform.idle) {
+            glfwWaitEventsTimeout(CSAND_IDLE_WAIT_TIMEOUT);
+            if (!platform.events_received) {
+                continue;
+            }
+        } else {
+            glfwPollEvents();
+        }
+        platform.events_received = false;
 
         if (platform.render_callback) {
             platform.render_callback(glfwGetTime());
@@ -238,6 +272,26 @@ void csandPlatformRun(void) {
     }
 }
 
+void csandPlatformSetIdle(bool idle) {
+    platform.idle = idle;
+}
+
 void csandPlatformPrintErr(const char *str) {
     fwrite(str, 1, strlen(str), stderr);
 }
+
+double csandPlatformGetTime(void) {
+    return glfwGetTime();
+}
+
+bool csandPlatformGlExtensionSupported(const char *name) {
+    return glfwExtensionSupported(name);
+}
+
+CsandGlProc csandPlatformGetGlProc(const char *name) {
+    return glfwGetProcAddress(name);
+}
+
+size_t csandPlatformGetFrameGlueAllocations(void) {
+    return 0;
+}
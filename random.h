@@ -7,11 +7,21 @@
 /* Maps probability from 0-1 float to 0-65535 uint16_t */
 #define NPROB(x) ((uint16_t)((x) * 0xFFFF))
 
+static inline uint64_t *csandRandState(void) {
+    static uint64_t seed = 1;
+    return &seed;
+}
+
 static inline uint32_t csandRand(void)
 {
-    static uint64_t seed = 1;
-    seed = 6364136223846793005*seed + 1;
-    return seed >> 32;
+    uint64_t *seed = csandRandState();
+    *seed = 6364136223846793005*(*seed) + 1;
+    return *seed >> 32;
+}
+
+// the same seed rolls the same dice, 1 is what it starts with
+static inline void csandSeedRand(uint64_t seed) {
+    *csandRandState() = seed;
 }
 
 static inline bool csandChance(uint16_t prob) {
@@ -23,4 +33,21 @@ static inline bool csandChance(uint16_t prob) {
     }
 }
 
+/* A random number that only depends on where and when it's asked for, so
+ * cells can roll their dice in any order and get the same results. */
+static inline uint32_t csandHashCell(uint32_t x, uint32_t y, uint32_t seed, uint32_t salt) {
+    uint32_t h = x * 0x8DA6B343u ^ y * 0xD8163841u ^ salt * 0xCB1AB31Fu ^ seed;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+// the same odds as csandChance for the same probability
+static inline bool csandHashChance(uint32_t hash, uint16_t prob) {
+    return hash % 0xFFFF < prob;
+}
+
 #endif
@@ -4,8 +4,19 @@
 #include "platform.h"
 #include "renderer.h"
 #include "vec2.h"
+#include "world.h"
 #include <GLES2/gl2.h>
+#ifdef __wasm__
+// gles2.js provides the extension functions as plain imports
+#define GL_GLEXT_PROTOTYPES
+#endif
+#include <GLES2/gl2ext.h>
 #include <stddef.h>
+#ifdef __wasm__
+#include "wasm_libc.h"
+#else
+#include <stdlib.h>
+#endif
 
 #define FONT_GLYPH_WIDTH 8
 #define FONT_GLYPH_HEIGHT 8
@@ -15,6 +26,54 @@
 
 #define CSAND_GLOW_RESOLUTION_FACTOR 2
 
+// in bytes, the nuklear vertex and element buffers grow from here as needed
+#define CSAND_NUKLEAR_INITIAL_BUFFER_SIZE (16 * 1024)
+// elements are 16-bit
+#define CSAND_NUKLEAR_MAX_VERTICES (1 << 16)
+
+// attributes get bound to their index here before linking, so programs sharing a vertex shader can share vertex arrays
+#define CSAND_X_ATTRIBUTES(x) \
+    x(POSITION, "position") \
+    x(UV, "uv") \
+    x(COLOR, "color")
+
+#define CSAND_X_UNIFORMS(x) \
+    x(TEXTURE, "texture") \
+    x(PALETTE, "palette") \
+    x(GLOW, "glow") \
+    x(PALETTE_SIZE, "palette_size") \
+    x(WORLD_SIZE, "world_size") \
+    x(FRAMEBUFFER_SIZE, "framebuffer_size") \
+    x(MATERIALS, "materials") \
+    x(MATERIALS_COUNT, "materials_count") \
+    x(BLOCK_OFFSET, "block_offset") \
+    x(SEED, "seed")
+
+#define CSAND_GEN_ATTRIBUTE_ENUM_ITEM(id, name) CSAND_ATTRIBUTE_##id,
+#define CSAND_GEN_UNIFORM_ENUM_ITEM(id, name) CSAND_UNIFORM_##id,
+#define CSAND_GEN_NAME_ITEM(id, name) name,
+
+typedef enum {
+    CSAND_X_ATTRIBUTES(CSAND_GEN_ATTRIBUTE_ENUM_ITEM)
+    CSAND_ATTRIBUTES_COUNT,
+} CsandAttribute;
+
+typedef enum {
+    CSAND_X_UNIFORMS(CSAND_GEN_UNIFORM_ENUM_ITEM)
+    CSAND_UNIFORMS_COUNT,
+} CsandUniform;
+
+static const char *const attribute_names[] = {CSAND_X_ATTRIBUTES(CSAND_GEN_NAME_ITEM)};
+static const char *const uniform_names[] = {CSAND_X_UNIFORMS(CSAND_GEN_NAME_ITEM)};
+static const char *const render_pass_names[] = {CSAND_X_RENDER_PASSES(CSAND_GEN_NAME_ITEM)};
+
+// locations are looked up once after linking, -1 for names the program doesn't use
+typedef struct CsandShaderProgram {
+    GLuint id;
+    GLint attributes[CSAND_ATTRIBUTES_COUNT];
+    GLint uniforms[CSAND_UNIFORMS_COUNT];
+} CsandShaderProgram;
+
 typedef struct CsandNuklearVertex {
     float pos[2];
     float uv[2];
@@ -24,23 +83,54 @@ typedef struct CsandNuklearVertex {
 typedef struct CsandRenderer {
     struct nk_user_font nk_font;
     CsandVec2Us world_size;
+    CsandVec2Ui camera;
+    bool world_uploaded;
     CsandVec2Us framebuffer_size;
     CsandVec2Us viewport_offset;
     CsandVec2Us viewport_size;
     bool glow_enabled;
     GLuint world_vbo;
-    GLuint world_program;
+    CsandShaderProgram world_program;
     GLuint glow_fbo;
-    GLuint glow_program;
+    CsandShaderProgram glow_program;
     GLuint nuklear_vbo;
-    GLuint nuklear_program;
+    GLuint nuklear_ebo;
+    CsandShaderProgram nuklear_program;
+    // both 0 without OES_vertex_array_object, the attributes get set up before every draw then
+    GLuint quad_vao;
+    GLuint nuklear_vao;
+    PFNGLGENVERTEXARRAYSOESPROC gen_vertex_arrays;
+    PFNGLBINDVERTEXARRAYOESPROC bind_vertex_array;
     struct nk_context nk_ctx;
     struct nk_convert_config nk_convert_config;
     struct nk_draw_command nuklear_ctx_buffer_data[8 * 1024];
     struct nk_draw_command nuklear_command_buffer_data[1024];
-    CsandNuklearVertex nuklear_vertex_buffer_data[64 * 1024];
-    nk_draw_index nuklear_element_buffer_data[256 * 1024];
     struct nk_buffer cmds, vertices, elements;
+    // sizes of the vbo and ebo storage, in bytes
+    size_t nuklear_vbo_size;
+    size_t nuklear_ebo_size;
+    // cmds, vertices and elements still hold the geometry for the ui with this hash
+    uint64_t nuklear_hash;
+    bool nuklear_converted;
+    bool nuklear_changed;
+    bool pass_timing;
+    double pass_start_time;
+    double pass_times[CSAND_RENDER_PASSES_COUNT];
+    GLuint render_texture;
+    // the gpu simulation steps from one texture into the other, sim_textures[sim_current] holds the latest state
+    bool sim_initialized;
+    bool sim_active;
+    GLuint sim_textures[2];
+    GLuint sim_fbos[2];
+    GLuint sim_materials_texture;
+    CsandShaderProgram sim_program;
+    unsigned int sim_current;
+    unsigned long sim_steps;
+    // the world position of the simulated area, which is whatever was in view when it started
+    CsandVec2Ui sim_camera;
+    // RGBA cells of the simulated area, for uploads and readbacks
+    unsigned char *sim_cells;
+    unsigned char chunk_upload_buffer[CSAND_CHUNK_AREA];
 } CsandRenderer;
 
 CsandRenderer csand_renderer = {0};
@@ -74,7 +164,13 @@ static const char csand_glow_frag_src[] = {
 };
 #define CSAND_GLOW_FRAG_SRC_LENGTH (sizeof(csand_glow_frag_src) - 1)
 
-static GLuint csandLoadShaderProgram(
+static const char csand_sim_frag_src[] = {
+#include "sim.frag.embed.h"
+    '\0'
+};
+#define CSAND_SIM_FRAG_SRC_LENGTH (sizeof(csand_sim_frag_src) - 1)
+
+static CsandShaderProgram csandLoadShaderProgram(
     const char *program_name,
     const char *vertex_shader_name, const char *vertex_shader_src, size_t vertex_shader_length,
     const char *fragment_shader_name, const char *fragment_shader_src, size_t fragment_shader_length
@@ -88,6 +184,7 @@ typedef enum {
     CSAND_TEXTURE_UNIT_PALETTE,
     CSAND_TEXTURE_UNIT_FONT,
     CSAND_TEXTURE_UNIT_GLOW,
+    CSAND_TEXTURE_UNIT_SIM_MATERIALS,
 } CsandTextureUnit;
 
 static float csandNuklearTextWidth(nk_handle handle, float h, const char *text, int length) {
@@ -111,6 +208,77 @@ static void setActiveTextureUnit(CsandTextureUnit unit) {
     glActiveTexture(GL_TEXTURE0 + unit);
 }
 
+static void csandLoadVertexArrayExtension(void) {
+    if (!csandPlatformGlExtensionSupported("GL_OES_vertex_array_object")) {
+        return;
+    }
+
+#ifdef __wasm__
+    csand_renderer.gen_vertex_arrays = glGenVertexArraysOES;
+    csand_renderer.bind_vertex_array = glBindVertexArrayOES;
+#else
+    csand_renderer.gen_vertex_arrays = (PFNGLGENVERTEXARRAYSOESPROC)csandPlatformGetGlProc("glGenVertexArraysOES");
+    csand_renderer.bind_vertex_array = (PFNGLBINDVERTEXARRAYOESPROC)csandPlatformGetGlProc("glBindVertexArrayOES");
+    if (csand_renderer.gen_vertex_arrays == NULL || csand_renderer.bind_vertex_array == NULL) {
+        csand_renderer.gen_vertex_arrays = NULL;
+        csand_renderer.bind_vertex_array = NULL;
+    }
+#endif
+}
+
+// records what the setup function does into a new vertex array, or returns 0 when there are none
+static GLuint csandCreateVertexArray(void (*setup)(void)) {
+    if (csand_renderer.gen_vertex_arrays == NULL) {
+        return 0;
+    }
+
+    GLuint vao;
+    csand_renderer.gen_vertex_arrays(1, &vao);
+    csand_renderer.bind_vertex_array(vao);
+    setup();
+    csand_renderer.bind_vertex_array(0);
+    return vao;
+}
+
+static void csandBindVertexArray(GLuint vao, void (*setup)(void)) {
+    if (vao != 0) {
+        csand_renderer.bind_vertex_array(vao);
+    } else {
+        setup();
+    }
+}
+
+static void csandSetupQuadAttributes(void) {
+    glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.world_vbo);
+    glVertexAttribPointer(CSAND_ATTRIBUTE_POSITION, 2, GL_BYTE, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(CSAND_ATTRIBUTE_POSITION);
+}
+
+static void csandSetupNuklearAttributes(void) {
+    glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.nuklear_vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, csand_renderer.nuklear_ebo);
+
+    glVertexAttribPointer(CSAND_ATTRIBUTE_POSITION, 2, GL_FLOAT, GL_FALSE, sizeof(CsandNuklearVertex), (void *)offsetof(CsandNuklearVertex, pos));
+    glEnableVertexAttribArray(CSAND_ATTRIBUTE_POSITION);
+
+    glVertexAttribPointer(CSAND_ATTRIBUTE_UV, 2, GL_FLOAT, GL_FALSE, sizeof(CsandNuklearVertex), (void *)offsetof(CsandNuklearVertex, uv));
+    glEnableVertexAttribArray(CSAND_ATTRIBUTE_UV);
+
+    glVertexAttribPointer(CSAND_ATTRIBUTE_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CsandNuklearVertex), (void *)offsetof(CsandNuklearVertex, color));
+    glEnableVertexAttribArray(CSAND_ATTRIBUTE_COLOR);
+}
+
+static void *csandNuklearAlloc(nk_handle handle, void *old, nk_size size) {
+    (void)handle;
+    (void)old;
+    return malloc(size);
+}
+
+static void csandNuklearFree(nk_handle handle, void *ptr) {
+    (void)handle;
+    free(ptr);
+}
+
 static void csandNuklearInit(void) {
     unsigned char font_atlas[FONT_ATLAS_HEIGHT][FONT_ATLAS_WIDTH];
     for (int y = 0; y < FONT_ATLAS_HEIGHT; y++) {
@@ -166,19 +334,14 @@ static void csandNuklearInit(void) {
         .vertex_alignment = NK_ALIGNOF(CsandNuklearVertex),
     };
 
-    GLuint ebo;
+    // storage for these gets allocated on the first upload
     glGenBuffers(1, &csand_renderer.nuklear_vbo);
-    glGenBuffers(1, &ebo);
-
-    glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.nuklear_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(csand_renderer.nuklear_vertex_buffer_data), NULL, GL_STREAM_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(csand_renderer.nuklear_element_buffer_data), NULL, GL_STREAM_DRAW);
+    glGenBuffers(1, &csand_renderer.nuklear_ebo);
 
+    struct nk_allocator allocator = {.alloc = csandNuklearAlloc, .free = csandNuklearFree};
     nk_buffer_init_fixed(&csand_renderer.cmds, csand_renderer.nuklear_command_buffer_data, sizeof(csand_renderer.nuklear_command_buffer_data));
-    nk_buffer_init_fixed(&csand_renderer.vertices, csand_renderer.nuklear_vertex_buffer_data, sizeof(csand_renderer.nuklear_vertex_buffer_data));
-    nk_buffer_init_fixed(&csand_renderer.elements, csand_renderer.nuklear_element_buffer_data, sizeof(csand_renderer.nuklear_element_buffer_data));
+    nk_buffer_init(&csand_renderer.vertices, &allocator, CSAND_NUKLEAR_INITIAL_BUFFER_SIZE);
+    nk_buffer_init(&csand_renderer.elements, &allocator, CSAND_NUKLEAR_INITIAL_BUFFER_SIZE);
 
     csand_renderer.nuklear_program = csandLoadShaderProgram(
         "nuklear",
@@ -186,8 +349,10 @@ static void csandNuklearInit(void) {
         "nuklear.frag", csand_nuklear_frag_src, CSAND_NUKLEAR_FRAG_SRC_LENGTH
     );
 
-    glUseProgram(csand_renderer.nuklear_program);
-    glUniform1i(glGetUniformLocation(csand_renderer.nuklear_program, "texture"), CSAND_TEXTURE_UNIT_FONT);
+    glUseProgram(csand_renderer.nuklear_program.id);
+    glUniform1i(csand_renderer.nuklear_program.uniforms[CSAND_UNIFORM_TEXTURE], CSAND_TEXTURE_UNIT_FONT);
+
+    csand_renderer.nuklear_vao = csandCreateVertexArray(csandSetupNuklearAttributes);
 }
 
 static void setupTexture(GLint interpolation) {
@@ -217,12 +382,17 @@ static void glowInit(void) {
         "glow.frag", csand_glow_frag_src, CSAND_GLOW_FRAG_SRC_LENGTH
     );
 
-    glUseProgram(csand_renderer.glow_program);
-    glUniform1i(glGetUniformLocation(csand_renderer.glow_program, "texture"), CSAND_TEXTURE_UNIT_RENDER);
-    glUniform1i(glGetUniformLocation(csand_renderer.glow_program, "palette"), CSAND_TEXTURE_UNIT_PALETTE);
+    glUseProgram(csand_renderer.glow_program.id);
+    glUniform1i(csand_renderer.glow_program.uniforms[CSAND_UNIFORM_TEXTURE], CSAND_TEXTURE_UNIT_RENDER);
+    glUniform1i(csand_renderer.glow_program.uniforms[CSAND_UNIFORM_PALETTE], CSAND_TEXTURE_UNIT_PALETTE);
 }
 
 void csandRendererInit(CsandVec2Us world_size, CsandVec2Us framebuffer_size, const CsandRgba *colors, uint8_t colors_count) {
+    // world chunks at the edges can have any width
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    csandLoadVertexArrayExtension();
+
     glGenBuffers(1, &csand_renderer.world_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.world_vbo);
     GLbyte vbo_data[3*2] = {
@@ -237,20 +407,20 @@ void csandRendererInit(CsandVec2Us world_size, CsandVec2Us framebuffer_size, con
         "shader.vert", vertex_shader_src, VERTEX_SHADER_SRC_LENGTH,
         "shader.frag", fragment_shader_src, FRAGMENT_SHADER_SRC_LENGTH
     );
-    glUseProgram(csand_renderer.world_program);
+    glUseProgram(csand_renderer.world_program.id);
 
-    GLuint render_texture;
-    glGenTextures(1, &render_texture);
+    glGenTextures(1, &csand_renderer.render_texture);
 
     setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
-    glBindTexture(GL_TEXTURE_2D, render_texture);
+    glBindTexture(GL_TEXTURE_2D, csand_renderer.render_texture);
     setupTexture(GL_NEAREST);
 
-    glUniform1i(glGetUniformLocation(csand_renderer.world_program, "texture"), CSAND_TEXTURE_UNIT_RENDER);
-    glUniform1i(glGetUniformLocation(csand_renderer.world_program, "palette"), CSAND_TEXTURE_UNIT_PALETTE);
-    glUniform1i(glGetUniformLocation(csand_renderer.world_program, "glow"), CSAND_TEXTURE_UNIT_GLOW);
+    glUniform1i(csand_renderer.world_program.uniforms[CSAND_UNIFORM_TEXTURE], CSAND_TEXTURE_UNIT_RENDER);
+    glUniform1i(csand_renderer.world_program.uniforms[CSAND_UNIFORM_PALETTE], CSAND_TEXTURE_UNIT_PALETTE);
+    glUniform1i(csand_renderer.world_program.uniforms[CSAND_UNIFORM_GLOW], CSAND_TEXTURE_UNIT_GLOW);
 
     glowInit();
+    csand_renderer.quad_vao = csandCreateVertexArray(csandSetupQuadAttributes);
 
     GLuint palette_texture;
     glGenTextures(1, &palette_texture);
@@ -270,15 +440,62 @@ void csandRendererSetPalette(const CsandRgba *colors, uint8_t colors_count) {
     setActiveTextureUnit(CSAND_TEXTURE_UNIT_PALETTE);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, colors_count, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, colors);
 
-    glUseProgram(csand_renderer.world_program);
-    glUniform1i(glGetUniformLocation(csand_renderer.world_program, "palette_size"), colors_count);
+    glUseProgram(csand_renderer.world_program.id);
+    glUniform1i(csand_renderer.world_program.uniforms[CSAND_UNIFORM_PALETTE_SIZE], colors_count);
 
-    glUseProgram(csand_renderer.glow_program);
-    glUniform1i(glGetUniformLocation(csand_renderer.glow_program, "palette_size"), colors_count);
+    glUseProgram(csand_renderer.glow_program.id);
+    glUniform1i(csand_renderer.glow_program.uniforms[CSAND_UNIFORM_PALETTE_SIZE], colors_count);
 }
 
-static void csandRendererRenderNuklear(void) {
-    nk_convert(
+static uint64_t csandHashBytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3u;
+    }
+
+    return hash;
+}
+
+/* FNV-1a over the commands nuklear recorded this frame, plus the order they
+ * get drawn in, since windows can swap places without their commands
+ * changing. Uninitialized padding in the commands may make equal frames hash
+ * differently, which only costs a conversion. */
+static uint64_t csandNuklearHashCommands(struct nk_context *ctx) {
+    const unsigned char *memory = nk_buffer_memory_const(&ctx->memory);
+    uint64_t hash = csandHashBytes(0xCBF29CE484222325u, memory, ctx->memory.allocated);
+
+    const struct nk_command *cmd = NULL;
+    nk_foreach(cmd, ctx) {
+        size_t offset = (const unsigned char *)cmd - memory;
+        hash = csandHashBytes(hash, &offset, sizeof(offset));
+    }
+
+    return hash;
+}
+
+// grows the buffer object's storage if it's too small, keeping the old size otherwise
+static void csandUploadNuklearBuffer(GLenum target, size_t *buffer_size, const struct nk_buffer *data) {
+    if (data->allocated > *buffer_size) {
+        *buffer_size = data->memory.size;
+        glBufferData(target, *buffer_size, NULL, GL_STREAM_DRAW);
+    }
+
+    glBufferSubData(target, 0, data->allocated, nk_buffer_memory_const(data));
+}
+
+// converts and uploads the ui, unless the geometry from last frame can be drawn again
+static bool csandNuklearConvert(void) {
+    uint64_t hash = csandNuklearHashCommands(&csand_renderer.nk_ctx);
+    csand_renderer.nuklear_changed = !csand_renderer.nuklear_converted || hash != csand_renderer.nuklear_hash;
+    if (!csand_renderer.nuklear_changed) {
+        return true;
+    }
+
+    nk_buffer_clear(&csand_renderer.cmds);
+    nk_buffer_clear(&csand_renderer.vertices);
+    nk_buffer_clear(&csand_renderer.elements);
+
+    nk_flags result = nk_convert(
         &csand_renderer.nk_ctx,
         &csand_renderer.cmds,
         &csand_renderer.vertices,
@@ -286,23 +503,27 @@ static void csandRendererRenderNuklear(void) {
         &csand_renderer.nk_convert_config
     );
 
-    glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.nuklear_vbo);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, csand_renderer.vertices.size, nk_buffer_memory_const(&csand_renderer.vertices));
-    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, csand_renderer.elements.size, nk_buffer_memory_const(&csand_renderer.elements));
-
-    GLint position_attr_loc = glGetAttribLocation(csand_renderer.nuklear_program, "position");
-    glVertexAttribPointer(position_attr_loc, 2, GL_FLOAT, GL_FALSE, sizeof(CsandNuklearVertex), (void *)offsetof(CsandNuklearVertex, pos));
-    glEnableVertexAttribArray(position_attr_loc);
+    csand_renderer.nuklear_converted = result == NK_CONVERT_SUCCESS
+        && csand_renderer.vertices.allocated <= CSAND_NUKLEAR_MAX_VERTICES * sizeof(CsandNuklearVertex);
+    csand_renderer.nuklear_hash = hash;
+    if (!csand_renderer.nuklear_converted) {
+        return false;
+    }
 
-    GLint uv_attr_loc = glGetAttribLocation(csand_renderer.nuklear_program, "uv");
-    glVertexAttribPointer(uv_attr_loc, 2, GL_FLOAT, GL_FALSE, sizeof(CsandNuklearVertex), (void *)offsetof(CsandNuklearVertex, uv));
-    glEnableVertexAttribArray(uv_attr_loc);
+    glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.nuklear_vbo);
+    csandUploadNuklearBuffer(GL_ARRAY_BUFFER, &csand_renderer.nuklear_vbo_size, &csand_renderer.vertices);
+    csandUploadNuklearBuffer(GL_ELEMENT_ARRAY_BUFFER, &csand_renderer.nuklear_ebo_size, &csand_renderer.elements);
+    return true;
+}
 
-    GLint color_attr_loc = glGetAttribLocation(csand_renderer.nuklear_program, "color");
-    glVertexAttribPointer(color_attr_loc, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CsandNuklearVertex), (void *)offsetof(CsandNuklearVertex, color));
-    glEnableVertexAttribArray(color_attr_loc);
+static void csandRendererRenderNuklear(void) {
+    // binds the element buffer too, which the upload needs
+    csandBindVertexArray(csand_renderer.nuklear_vao, csandSetupNuklearAttributes);
+    if (!csandNuklearConvert()) {
+        return;
+    }
 
-    glUseProgram(csand_renderer.nuklear_program);
+    glUseProgram(csand_renderer.nuklear_program.id);
     setActiveTextureUnit(CSAND_TEXTURE_UNIT_FONT);
 
     glEnable(GL_BLEND);
@@ -311,7 +532,7 @@ static void csandRendererRenderNuklear(void) {
     glEnable(GL_SCISSOR_TEST);
 
     glViewport(0, 0, csand_renderer.framebuffer_size.x, csand_renderer.framebuffer_size.y);
-    glUniform2f(glGetUniformLocation(csand_renderer.nuklear_program, "framebuffer_size"), csand_renderer.framebuffer_size.x, csand_renderer.framebuffer_size.y);
+    glUniform2f(csand_renderer.nuklear_program.uniforms[CSAND_UNIFORM_FRAMEBUFFER_SIZE], csand_renderer.framebuffer_size.x, csand_renderer.framebuffer_size.y);
 
     const struct nk_draw_command *cmd = NULL;
     unsigned int drawn_elements = 0;
@@ -327,19 +548,11 @@ static void csandRendererRenderNuklear(void) {
 
     glDisable(GL_SCISSOR_TEST);
     glDisable(GL_BLEND);
-
-    nk_buffer_clear(&csand_renderer.elements);
-    nk_buffer_clear(&csand_renderer.vertices);
-    nk_buffer_clear(&csand_renderer.cmds);
 }
 
-static void drawFullscreenQuad(GLuint program) {
-    glBindBuffer(GL_ARRAY_BUFFER, csand_renderer.world_vbo);
-    GLint position_attr_loc = glGetAttribLocation(program, "position");
-    glVertexAttribPointer(position_attr_loc, 2, GL_BYTE, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(position_attr_loc);
-
-    glUseProgram(program);
+static void drawFullscreenQuad(const CsandShaderProgram *program) {
+    csandBindVertexArray(csand_renderer.quad_vao, csandSetupQuadAttributes);
+    glUseProgram(program->id);
 
     glEnable(GL_CULL_FACE);
 
@@ -348,10 +561,94 @@ static void drawFullscreenQuad(GLuint program) {
     glDisable(GL_CULL_FACE);
 }
 
-void csandRendererRender(unsigned char *data, unsigned short width, unsigned short height) {
-    if (width != csand_renderer.world_size.x || height != csand_renderer.world_size.y) {
-        csandUpdateWorldSize((CsandVec2Us){width, height});
+/* Uploads the chunks in view that changed since the last frame. Chunks that
+ * aren't stored as plain bytes or only partly show are decoded into a scratch
+ * buffer first. */
+static void csandUploadWorld(CsandWorld *world, CsandVec2Ui camera, bool upload_all) {
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
+
+    unsigned int view_end_x = camera.x + csand_renderer.world_size.x;
+    unsigned int view_end_y = camera.y + csand_renderer.world_size.y;
+
+    for (unsigned int chunk_y = camera.y >> CSAND_CHUNK_SIZE_LOG2; chunk_y << CSAND_CHUNK_SIZE_LOG2 < view_end_y; chunk_y++) {
+        for (unsigned int chunk_x = camera.x >> CSAND_CHUNK_SIZE_LOG2; chunk_x << CSAND_CHUNK_SIZE_LOG2 < view_end_x; chunk_x++) {
+            // missing chunks are air and only need uploading once
+            CsandChunk *chunk = csandWorldFindChunk(world, chunk_x, chunk_y);
+            if (!upload_all && (chunk == NULL || !chunk->dirty)) {
+                continue;
+            }
+
+            if (chunk != NULL) {
+                chunk->dirty = false;
+            }
+
+            unsigned int chunk_start_x = chunk_x << CSAND_CHUNK_SIZE_LOG2;
+            unsigned int chunk_start_y = chunk_y << CSAND_CHUNK_SIZE_LOG2;
+            unsigned int x = csandUiMax(chunk_start_x, camera.x);
+            unsigned int y = csandUiMax(chunk_start_y, camera.y);
+            unsigned int width = csandUiMin(chunk_start_x + CSAND_CHUNK_SIZE, view_end_x) - x;
+            unsigned int height = csandUiMin(chunk_start_y + CSAND_CHUNK_SIZE, view_end_y) - y;
+            const unsigned char *cells = chunk != NULL ? chunk->cells : NULL;
+
+            if (cells == NULL || width != CSAND_CHUNK_SIZE || !CSAND_CHUNK_ROWS_CONTIGUOUS) {
+                unsigned char *buffer = csand_renderer.chunk_upload_buffer;
+                csandWorldReadChunk(world, chunk, buffer);
+
+                unsigned int offset = (y - chunk_start_y) * CSAND_CHUNK_SIZE + (x - chunk_start_x);
+                for (unsigned int row = 0; row < height; row++) {
+                    for (unsigned int column = 0; column < width; column++) {
+                        buffer[row * width + column] = buffer[offset + row * CSAND_CHUNK_SIZE + column];
+                    }
+                }
+
+                cells = buffer;
+            } else {
+                cells += (y - chunk_start_y) * CSAND_CHUNK_SIZE;
+            }
+
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x - camera.x, y - camera.y, width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, cells);
+        }
+    }
+}
+
+static void csandBeginPasses(void) {
+    if (csand_renderer.pass_timing) {
+        glFinish();
+        csand_renderer.pass_start_time = csandPlatformGetTime();
     }
+}
+
+// the next pass starts where this one ends
+static void csandEndPass(CsandRenderPass pass) {
+    if (csand_renderer.pass_timing) {
+        glFinish();
+        double now = csandPlatformGetTime();
+        csand_renderer.pass_times[pass] = now - csand_renderer.pass_start_time;
+        csand_renderer.pass_start_time = now;
+    }
+}
+
+static void csandGpuSimUpload(const CsandWorld *world, CsandVec2Ui camera);
+static void csandGpuSimDownload(CsandWorld *world);
+
+void csandRendererRender(CsandWorld *world, CsandVec2Ui camera) {
+    unsigned short width = csand_renderer.world_size.x;
+    unsigned short height = csand_renderer.world_size.y;
+
+    // the gpu simulation follows the camera by handing the old area back to the world
+    if (csand_renderer.sim_active && (camera.x != csand_renderer.sim_camera.x || camera.y != csand_renderer.sim_camera.y)) {
+        csandGpuSimDownload(world);
+        csandGpuSimUpload(world, camera);
+    }
+
+    // the texture only holds what's in view, so anything but new changes invalidates all of it
+    bool upload_all = !csand_renderer.world_uploaded || world->chunks_removed ||
+        camera.x != csand_renderer.camera.x || camera.y != csand_renderer.camera.y;
+    csand_renderer.world_uploaded = true;
+    csand_renderer.camera = camera;
+    world->chunks_removed = false;
+
+    csandBeginPasses();
 
     glBindFramebuffer(GL_FRAMEBUFFER, csand_renderer.glow_fbo);
     glClearColor(0, 0, 0, 1);
@@ -359,16 +656,19 @@ void csandRendererRender(unsigned char *data, unsigned short width, unsigned sho
 
     if (csand_renderer.glow_enabled) {
         glViewport(0, 0, width * CSAND_GLOW_RESOLUTION_FACTOR, height * CSAND_GLOW_RESOLUTION_FACTOR);
-        drawFullscreenQuad(csand_renderer.glow_program);
+        drawFullscreenQuad(&csand_renderer.glow_program);
     }
+    csandEndPass(CSAND_RENDER_PASS_GLOW);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     glClearColor(0.06, 0.12, 0.17, 1.0);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+    // the texture in view is the one the gpu simulation writes to
+    if (!csand_renderer.sim_active) {
+        csandUploadWorld(world, camera, upload_all);
+    }
 
     glViewport(
         csand_renderer.viewport_offset.x,
@@ -377,9 +677,11 @@ void csandRendererRender(unsigned char *data, unsigned short width, unsigned sho
         csand_renderer.viewport_size.y
     );
 
-    drawFullscreenQuad(csand_renderer.world_program);
+    drawFullscreenQuad(&csand_renderer.world_program);
+    csandEndPass(CSAND_RENDER_PASS_WORLD);
 
     csandRendererRenderNuklear();
+    csandEndPass(CSAND_RENDER_PASS_NUKLEAR);
 }
 
 void csandRendererUpdateViewport(CsandVec2Us framebuffer_size) {
@@ -433,7 +735,214 @@ struct nk_context *csandRendererNuklearContext(void) {
     return &csand_renderer.nk_ctx;
 }
 
-static GLuint csandLoadShaderProgram(
+bool csandRendererUiChanged(void) {
+    return csand_renderer.nuklear_changed;
+}
+
+void csandRendererSetPassTiming(bool enabled) {
+    csand_renderer.pass_timing = enabled;
+    for (int i = 0; i < CSAND_RENDER_PASSES_COUNT; i++) {
+        csand_renderer.pass_times[i] = 0;
+    }
+}
+
+double csandRendererGetPassTime(CsandRenderPass pass) {
+    return csand_renderer.pass_times[pass];
+}
+
+const char *csandRendererPassName(CsandRenderPass pass) {
+    return render_pass_names[pass];
+}
+
+// set up on first use, most sessions never turn the gpu simulation on
+static bool csandGpuSimInit(void) {
+    if (csand_renderer.sim_initialized) {
+        return csand_renderer.sim_program.id != 0;
+    }
+    csand_renderer.sim_initialized = true;
+
+    csand_renderer.sim_program = csandLoadShaderProgram(
+        "sim",
+        "shader.vert", vertex_shader_src, VERTEX_SHADER_SRC_LENGTH,
+        "sim.frag", csand_sim_frag_src, CSAND_SIM_FRAG_SRC_LENGTH
+    );
+
+    glUseProgram(csand_renderer.sim_program.id);
+    glUniform1i(csand_renderer.sim_program.uniforms[CSAND_UNIFORM_TEXTURE], CSAND_TEXTURE_UNIT_RENDER);
+    glUniform1i(csand_renderer.sim_program.uniforms[CSAND_UNIFORM_MATERIALS], CSAND_TEXTURE_UNIT_SIM_MATERIALS);
+    glUniform2i(csand_renderer.sim_program.uniforms[CSAND_UNIFORM_WORLD_SIZE], csand_renderer.world_size.x, csand_renderer.world_size.y);
+
+    glGenTextures(1, &csand_renderer.sim_materials_texture);
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_SIM_MATERIALS);
+    glBindTexture(GL_TEXTURE_2D, csand_renderer.sim_materials_texture);
+    setupTexture(GL_NEAREST);
+
+    glGenTextures(2, csand_renderer.sim_textures);
+    glGenFramebuffers(2, csand_renderer.sim_fbos);
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
+    bool complete = true;
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, csand_renderer.sim_textures[i]);
+        setupTexture(GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, csand_renderer.world_size.x, csand_renderer.world_size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, csand_renderer.sim_fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, csand_renderer.sim_textures[i], 0);
+        complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, csand_renderer.render_texture);
+
+    csand_renderer.sim_cells = malloc((size_t)csand_renderer.world_size.x * csand_renderer.world_size.y * 4);
+
+    if (!complete || csand_renderer.sim_cells == NULL) {
+        csandPlatformPrintErr(!complete ? "can't render into RGBA textures, no gpu simulation\n" : "failed to allocate the gpu simulation cells\n");
+        glDeleteProgram(csand_renderer.sim_program.id);
+        csand_renderer.sim_program.id = 0;
+        return false;
+    }
+
+    return csand_renderer.sim_program.id != 0;
+}
+
+static void csandGpuSimUpload(const CsandWorld *world, CsandVec2Ui camera) {
+    unsigned char *cells = csand_renderer.sim_cells;
+    for (unsigned int y = 0; y < csand_renderer.world_size.y; y++) {
+        for (unsigned int x = 0; x < csand_renderer.world_size.x; x++) {
+            unsigned char *cell = cells + (y * csand_renderer.world_size.x + x) * 4;
+            cell[0] = csandWorldGetMat(world, camera.x + x, camera.y + y);
+            cell[1] = 0;
+            cell[2] = 0;
+            cell[3] = 0xFF;
+        }
+    }
+
+    csand_renderer.sim_camera = camera;
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
+    glBindTexture(GL_TEXTURE_2D, csand_renderer.sim_textures[csand_renderer.sim_current]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, csand_renderer.world_size.x, csand_renderer.world_size.y, GL_RGBA, GL_UNSIGNED_BYTE, cells);
+}
+
+// only the cells that differ get written, so the rest of the world stays asleep
+static void csandGpuSimDownload(CsandWorld *world) {
+    unsigned char *cells = csand_renderer.sim_cells;
+    glBindFramebuffer(GL_FRAMEBUFFER, csand_renderer.sim_fbos[csand_renderer.sim_current]);
+    glReadPixels(0, 0, csand_renderer.world_size.x, csand_renderer.world_size.y, GL_RGBA, GL_UNSIGNED_BYTE, cells);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    CsandVec2Ui camera = csand_renderer.sim_camera;
+    for (unsigned int y = 0; y < csand_renderer.world_size.y; y++) {
+        for (unsigned int x = 0; x < csand_renderer.world_size.x; x++) {
+            unsigned char mat = cells[(y * csand_renderer.world_size.x + x) * 4];
+            if (csandWorldGetMat(world, camera.x + x, camera.y + y) != mat) {
+                csandWorldSetMat(world, camera.x + x, camera.y + y, mat);
+            }
+        }
+    }
+}
+
+void csandRendererGpuSimSetMaterials(const CsandGpuSimMaterial *materials, uint8_t materials_count) {
+    if (!csandGpuSimInit()) {
+        return;
+    }
+
+    unsigned char texels[UINT8_MAX + 1][CSAND_GPU_SIM_MATERIAL_TEXELS][4];
+    for (unsigned int i = 0; i < materials_count; i++) {
+        const CsandGpuSimMaterial *mat = &materials[i];
+        unsigned char (*row)[4] = texels[i];
+        row[0][0] = mat->kind;
+        row[0][1] = mat->density_rank;
+        row[0][2] = mat->fire;
+        row[0][3] = mat->decay_mat;
+        row[1][0] = mat->decay_prob >> 8;
+        row[1][1] = mat->decay_prob;
+        row[1][2] = mat->ignition_prob >> 8;
+        row[1][3] = mat->ignition_prob;
+        row[2][0] = mat->burn_mats[0];
+        row[2][1] = mat->burn_mats[1];
+        row[2][2] = 0;
+        row[2][3] = 0;
+    }
+
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_SIM_MATERIALS);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, CSAND_GPU_SIM_MATERIAL_TEXELS, materials_count, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+
+    glUseProgram(csand_renderer.sim_program.id);
+    glUniform1i(csand_renderer.sim_program.uniforms[CSAND_UNIFORM_MATERIALS_COUNT], materials_count);
+}
+
+bool csandRendererGpuSimStart(const CsandWorld *world, CsandVec2Ui camera) {
+    if (csand_renderer.sim_active) {
+        return true;
+    }
+
+    if (!csandGpuSimInit()) {
+        return false;
+    }
+
+    csandGpuSimUpload(world, camera);
+    csand_renderer.sim_active = true;
+    return true;
+}
+
+void csandRendererGpuSimStop(CsandWorld *world) {
+    if (!csand_renderer.sim_active) {
+        return;
+    }
+
+    csandGpuSimDownload(world);
+    csand_renderer.sim_active = false;
+
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
+    glBindTexture(GL_TEXTURE_2D, csand_renderer.render_texture);
+    csand_renderer.world_uploaded = false;
+}
+
+bool csandRendererGpuSimActive(void) {
+    return csand_renderer.sim_active;
+}
+
+/* Renders the next state into the other texture. Blocks start on even cells
+ * every other step and on odd ones in between, so cells can cross block
+ * borders. */
+void csandRendererGpuSimStep(uint32_t seed) {
+    unsigned int next = csand_renderer.sim_current ^ 1;
+    glBindFramebuffer(GL_FRAMEBUFFER, csand_renderer.sim_fbos[next]);
+    glViewport(0, 0, csand_renderer.world_size.x, csand_renderer.world_size.y);
+
+    glUseProgram(csand_renderer.sim_program.id);
+    glUniform1i(csand_renderer.sim_program.uniforms[CSAND_UNIFORM_BLOCK_OFFSET], csand_renderer.sim_steps & 1);
+    // small offsets, so the hash doesn't run out of float precision
+    glUniform2f(csand_renderer.sim_program.uniforms[CSAND_UNIFORM_SEED], seed & 0xFFF, (seed >> 12) & 0xFFF);
+    drawFullscreenQuad(&csand_renderer.sim_program);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    csand_renderer.sim_current = next;
+    csand_renderer.sim_steps++;
+
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
+    glBindTexture(GL_TEXTURE_2D, csand_renderer.sim_textures[next]);
+}
+
+void csandRendererGpuSimSetCell(unsigned int x, unsigned int y, unsigned char mat) {
+    unsigned int view_x = x - csand_renderer.sim_camera.x;
+    unsigned int view_y = y - csand_renderer.sim_camera.y;
+    if (view_x >= csand_renderer.world_size.x || view_y >= csand_renderer.world_size.y) {
+        return;
+    }
+
+    const unsigned char cell[4] = {mat, 0, 0, 0xFF};
+    setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, view_x, view_y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, cell);
+}
+
+void csandRendererGpuSimDownload(CsandWorld *world) {
+    if (csand_renderer.sim_active) {
+        csandGpuSimDownload(world);
+    }
+}
+
+static CsandShaderProgram csandLoadShaderProgram(
     const char *program_name,
     const char *vertex_shader_name, const char *vertex_shader_src, size_t vertex_shader_length,
     const char *fragment_shader_name, const char *fragment_shader_src, size_t fragment_shader_length
@@ -443,6 +952,11 @@ static GLuint csandLoadShaderProgram(
     GLuint program = glCreateProgram();
     glAttachShader(program, vertex_shader);
     glAttachShader(program, fragment_shader);
+
+    for (unsigned int i = 0; i < CSAND_ATTRIBUTES_COUNT; i++) {
+        glBindAttribLocation(program, i, attribute_names[i]);
+    }
+
     glLinkProgram(program);
 
     GLint status;
@@ -463,7 +977,16 @@ static GLuint csandLoadShaderProgram(
     glDeleteShader(fragment_shader);
     glDeleteShader(vertex_shader);
 
-    return program;
+    CsandShaderProgram result = {program, {0}, {0}};
+    for (unsigned int i = 0; i < CSAND_ATTRIBUTES_COUNT; i++) {
+        result.attributes[i] = program != 0 ? glGetAttribLocation(program, attribute_names[i]) : -1;
+    }
+
+    for (unsigned int i = 0; i < CSAND_UNIFORMS_COUNT; i++) {
+        result.uniforms[i] = program != 0 ? glGetUniformLocation(program, uniform_names[i]) : -1;
+    }
+
+    return result;
 }
 
 static GLuint csandLoadShader(const char *name, const char *src, size_t size, GLenum type) {
@@ -495,12 +1018,13 @@ static GLuint csandLoadShader(const char *name, const char *src, size_t size, GL
 
 static void csandUpdateWorldSize(CsandVec2Us world_size) {
     csand_renderer.world_size = world_size;
+    csand_renderer.world_uploaded = false;
 
     setActiveTextureUnit(CSAND_TEXTURE_UNIT_RENDER);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, world_size.x, world_size.y, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
 
     setActiveTextureUnit(CSAND_TEXTURE_UNIT_GLOW);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, world_size.x * CSAND_GLOW_RESOLUTION_FACTOR, world_size.y * CSAND_GLOW_RESOLUTION_FACTOR, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glUseProgram(csand_renderer.glow_program);
-    glUniform2i(glGetUniformLocation(csand_renderer.glow_program, "world_size"), world_size.x, world_size.y);
+    glUseProgram(csand_renderer.glow_program.id);
+    glUniform2i(csand_renderer.glow_program.uniforms[CSAND_UNIFORM_WORLD_SIZE], world_size.x, world_size.y);
 }
@@ -4,16 +4,67 @@
 #include "nuklear_config.h"
 #include "rgba.h"
 #include "vec2.h"
+#include "world.h"
 #include <stdbool.h>
 #include <stdint.h>
 
+#define CSAND_X_RENDER_PASSES(x) \
+    x(GLOW, "glow") \
+    x(WORLD, "world") \
+    x(NUKLEAR, "nuklear")
+
+#define CSAND_GEN_RENDER_PASS_ENUM_ITEM(id, name) CSAND_RENDER_PASS_##id,
+
+typedef enum {
+    CSAND_X_RENDER_PASSES(CSAND_GEN_RENDER_PASS_ENUM_ITEM)
+    CSAND_RENDER_PASSES_COUNT,
+} CsandRenderPass;
+
+// texels per material in the properties texture, sim.frag expects 3
+#define CSAND_GPU_SIM_MATERIAL_TEXELS 3
+
+// what the gpu simulation knows about a material
+typedef struct CsandGpuSimMaterial {
+    // solid, powder or fluid, numbered like in csand.c
+    uint8_t kind;
+    // only the order matters, heavier materials sink below lighter ones
+    uint8_t density_rank;
+    bool fire;
+    uint8_t decay_mat;
+    uint16_t decay_prob;
+    uint16_t ignition_prob;
+    // catching fire turns the material into either of these
+    uint8_t burn_mats[2];
+} CsandGpuSimMaterial;
+
 void csandRendererInit(CsandVec2Us world_size, CsandVec2Us framebuffer_size, const CsandRgba *colors, uint8_t colors_count);
 void csandRendererSetPalette(const CsandRgba *colors, uint8_t colors_count);
-void csandRendererRender(unsigned char *data, unsigned short width, unsigned short height);
+void csandRendererRender(CsandWorld *world, CsandVec2Ui camera);
 void csandRendererUpdateViewport(CsandVec2Us framebuffer_size);
 bool csandRendererGetGlow(void);
 void csandRendererSetGlow(bool enabled);
 CsandVec2Us csandRendererScreenSpaceToWorldSpace(CsandVec2Us vec);
 struct nk_context *csandRendererNuklearContext(void);
+// whether the ui drawn by the last csandRendererRender looked any different from the frame before
+bool csandRendererUiChanged(void);
+// timing waits for the GPU to finish each pass, so it slows rendering down
+void csandRendererSetPassTiming(bool enabled);
+// in seconds, how long the pass took during the last csandRendererRender, 0 while timing is off
+double csandRendererGetPassTime(CsandRenderPass pass);
+const char *csandRendererPassName(CsandRenderPass pass);
+
+/* The gpu simulation runs the world in view in fragment shaders, see
+ * sim.frag. The cells stay on the gpu while it's active, so the world only
+ * gets them back from csandRendererGpuSimDownload, csandRendererGpuSimStop
+ * or when the camera moves. */
+void csandRendererGpuSimSetMaterials(const CsandGpuSimMaterial *materials, uint8_t materials_count);
+// false when the gpu can't do it, the world keeps simulating on the cpu then
+bool csandRendererGpuSimStart(const CsandWorld *world, CsandVec2Ui camera);
+void csandRendererGpuSimStop(CsandWorld *world);
+bool csandRendererGpuSimActive(void);
+void csandRendererGpuSimStep(uint32_t seed);
+// in world coordinates, cells out of view are ignored
+void csandRendererGpuSimSetCell(unsigned int x, unsigned int y, unsigned char mat);
+void csandRendererGpuSimDownload(CsandWorld *world);
 
 #endif
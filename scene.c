@@ -0,0 +1,460 @@
+#ifndef __wasm__
+// for sysconf
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "materials.h"
+#include "math.h"
+#include "platform.h"
+#include "random.h"
+#include "scene.h"
+#ifdef __wasm__
+#include "wasm_libc.h"
+#else
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#ifndef __wasm__
+#define CSAND_SCENE_THREADS
+#define CSAND_SCENE_MAX_THREADS 64
+#endif
+
+/* Noise lattices are never finer than this, so the lattice points around a
+ * chunk fit in a few hundred bytes of stack, even in the web build. */
+#define CSAND_SCENE_MIN_NOISE_LOG2 3
+#define CSAND_SCENE_LATTICE_SIZE ((CSAND_CHUNK_SIZE >> CSAND_SCENE_MIN_NOISE_LOG2) + 2)
+
+// every kind of feature rolls its own dice
+enum {
+    CSAND_SCENE_SALT_HILLS,
+    CSAND_SCENE_SALT_CAVES,
+    CSAND_SCENE_SALT_COAL,
+    CSAND_SCENE_SALT_HYDROGEN,
+    CSAND_SCENE_SALT_TREES,
+};
+
+// heights and depths are fractions of the height of the scene
+typedef struct CsandSceneParams {
+    // where the ground is on average
+    float land;
+    // how far it goes up and down from there
+    float hills;
+    // anything lower that isn't ground is water, with oil on top
+    float sea;
+    // how thick the sand over the rock is
+    float sand;
+    // how much of the rock is hollowed out
+    float caves;
+    // chance that a spot on dry land grows a tree
+    uint16_t trees;
+    bool coal;
+    bool hydrogen;
+} CsandSceneParams;
+
+static const CsandSceneParams scene_params[CSAND_SCENES_COUNT] = {
+    [CSAND_SCENE_LANDSCAPE] = {0.45f, 0.2f,  0.4f,  0.03f, 0.1f,  NPROB(0.5), true,  true},
+    [CSAND_SCENE_OCEAN]     = {0.25f, 0.15f, 0.7f,  0.04f, 0.05f, NPROB(0),   false, false},
+    [CSAND_SCENE_FOREST]    = {0.35f, 0.1f,  0.0f,  0.02f, 0.05f, NPROB(0.9), true,  false},
+    [CSAND_SCENE_CAVES]     = {0.85f, 0.05f, 0.0f,  0.01f, 0.3f,  NPROB(0.3), true,  true},
+};
+
+const char *const csand_scene_names[CSAND_SCENES_COUNT] = {CSAND_X_SCENES(CSAND_GEN_SCENE_NAME)};
+
+// the params worked out in cells for one size of scene, coordinates are relative to its corner
+typedef struct CsandSceneLayout {
+    const CsandSceneParams *params;
+    uint32_t seed;
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+    // lattice spacings of the noise as powers of 2, they grow with the scene
+    unsigned int hills_log2;
+    unsigned int caves_log2;
+    unsigned int sea_level;
+    unsigned int sand_depth;
+    unsigned int oil_depth;
+    // rock closer to the surface than this is never hollowed out
+    unsigned int cave_cover;
+    unsigned int coal_spacing;
+    unsigned int coal_thickness;
+    // every spot this wide gets at most one tree, and its canopy stays within the spot
+    unsigned int tree_spacing;
+    unsigned int trunk_height;
+    unsigned int trunk_radius;
+    unsigned int canopy_radius;
+} CsandSceneLayout;
+
+typedef struct CsandSceneColumn {
+    unsigned int ground;
+    // seams run along the rock every coal_spacing cells, shifted up by this much
+    unsigned int coal_offset;
+    bool coal;
+    // rows of the trunk or the canopy of a tree, empty if there's none
+    unsigned int wood_start;
+    unsigned int wood_end;
+} CsandSceneColumn;
+
+/* One octave of noise over a chunk, with the lattice points around it and
+ * the weights of every column and row worked out up front, so cells only
+ * have to interpolate. */
+typedef struct CsandSceneNoise {
+    float lattice[CSAND_SCENE_LATTICE_SIZE][CSAND_SCENE_LATTICE_SIZE];
+    unsigned int lattice_rows;
+    unsigned char lattice_x[CSAND_CHUNK_SIZE];
+    unsigned char lattice_y[CSAND_CHUNK_SIZE];
+    float weights_x[CSAND_CHUNK_SIZE];
+    float weights_y[CSAND_CHUNK_SIZE];
+} CsandSceneNoise;
+
+typedef struct CsandSceneWork {
+    const CsandSceneLayout *layout;
+    CsandChunk **chunks;
+    size_t chunks_count;
+    // chunks are dealt out like cards, every thread takes each step-th one from first
+    size_t first;
+    size_t step;
+} CsandSceneWork;
+
+bool csandSceneFromName(const char *name, CsandScene *scene) {
+    for (int i = 0; i < CSAND_SCENES_COUNT; i++) {
+        const char *a = name;
+        const char *b = csand_scene_names[i];
+        while (*a != '\0' && *a == *b) {
+            a++;
+            b++;
+        }
+
+        if (*a == *b) {
+            *scene = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static unsigned int csandSceneLog2(unsigned int n) {
+    unsigned int log2 = 0;
+    while (n >> (log2 + 1) != 0) {
+        log2++;
+    }
+
+    return log2;
+}
+
+// 0 to 1, with 24 bits so it never rounds up to 1
+static float csandSceneLatticeValue(uint32_t seed, uint32_t salt, unsigned int x, unsigned int y) {
+    return (csandHashCell(x, y, seed, salt) >> 8) * (1.0f / 16777216.0f);
+}
+
+static float csandSceneSmooth(unsigned int offset, unsigned int log2) {
+    float t = offset / (float)(1u << log2);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// value noise along a line, for the ground
+static float csandSceneNoise1(uint32_t seed, uint32_t salt, unsigned int x, unsigned int log2) {
+    unsigned int lattice_x = x >> log2;
+    float a = csandSceneLatticeValue(seed, salt, lattice_x, 0);
+    float b = csandSceneLatticeValue(seed, salt, lattice_x + 1, 0);
+    return a + (b - a) * csandSceneSmooth(x & ((1u << log2) - 1), log2);
+}
+
+// covers the width x height cells at x, y, neither can be more than a chunk
+static void csandSceneNoiseInit(CsandSceneNoise *noise, uint32_t seed, uint32_t salt, unsigned int log2, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+    unsigned int mask = (1u << log2) - 1;
+    unsigned int base_x = x >> log2;
+    unsigned int base_y = y >> log2;
+
+    for (unsigned int i = 0; i < width; i++) {
+        noise->lattice_x[i] = ((x + i) >> log2) - base_x;
+        noise->weights_x[i] = csandSceneSmooth((x + i) & mask, log2);
+    }
+    for (unsigned int j = 0; j < height; j++) {
+        noise->lattice_y[j] = ((y + j) >> log2) - base_y;
+        noise->weights_y[j] = csandSceneSmooth((y + j) & mask, log2);
+    }
+
+    noise->lattice_rows = noise->lattice_y[height - 1] + 2;
+    for (unsigned int j = 0; j < noise->lattice_rows; j++) {
+        for (unsigned int i = 0; i <= noise->lattice_x[width - 1] + 1u; i++) {
+            noise->lattice[j][i] = csandSceneLatticeValue(seed, salt, base_x + i, base_y + j);
+        }
+    }
+}
+
+/* Blends the lattice points of the rows around column i, so going up the
+ * column only has to blend between two of those. i counts from the corner
+ * csandSceneNoiseInit was given. */
+static void csandSceneNoiseColumn(const CsandSceneNoise *noise, unsigned int i, float column[CSAND_SCENE_LATTICE_SIZE]) {
+    unsigned int lattice_x = noise->lattice_x[i];
+    float tx = noise->weights_x[i];
+    for (unsigned int k = 0; k < noise->lattice_rows; k++) {
+        const float *row = noise->lattice[k] + lattice_x;
+        column[k] = row[0] + (row[1] - row[0]) * tx;
+    }
+}
+
+static float csandSceneNoiseAt(const CsandSceneNoise *noise, const float column[CSAND_SCENE_LATTICE_SIZE], unsigned int j) {
+    const float *below = column + noise->lattice_y[j];
+    return below[0] + (below[1] - below[0]) * noise->weights_y[j];
+}
+
+static CsandSceneLayout csandSceneLayout(CsandScene scene, uint32_t seed, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+    const CsandSceneParams *params = &scene_params[scene];
+    CsandSceneLayout layout = {
+        .params = params,
+        .seed = seed,
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height,
+        .hills_log2 = csandUiMax(csandSceneLog2(width), 6) - 2,
+        .caves_log2 = csandUiMax(csandSceneLog2(csandUiMin(width, height)), 8) - 4,
+        .sea_level = params->sea * height,
+        .sand_depth = params->sand * height + 1,
+        .oil_depth = csandUiMax(height / 100, 2),
+        .trunk_height = csandUiMax(height / 40, 4),
+    };
+
+    layout.cave_cover = 2 * layout.sand_depth + 2;
+    layout.coal_spacing = 1u << layout.caves_log2;
+    layout.coal_thickness = csandUiMax(layout.coal_spacing / 16, 1);
+    layout.canopy_radius = csandUiMax(layout.trunk_height / 2, 2);
+    layout.trunk_radius = layout.canopy_radius / 6;
+    layout.tree_spacing = 3 * layout.canopy_radius;
+    return layout;
+}
+
+static unsigned int csandSceneGround(const CsandSceneLayout *layout, unsigned int x) {
+    uint32_t seed = layout->seed;
+    float noise = 0.6f * csandSceneNoise1(seed, CSAND_SCENE_SALT_HILLS, x, layout->hills_log2) +
+        0.3f * csandSceneNoise1(seed, CSAND_SCENE_SALT_HILLS, x, layout->hills_log2 - 2) +
+        0.1f * csandSceneNoise1(seed, CSAND_SCENE_SALT_HILLS, x, layout->hills_log2 - 4);
+
+    float ground = (layout->params->land + layout->params->hills * (2.0f * noise - 1.0f)) * layout->height;
+    return csandFClamp(ground, 1.0f, layout->height - 1.0f);
+}
+
+static CsandSceneColumn csandSceneColumn(const CsandSceneLayout *layout, unsigned int x) {
+    uint32_t seed = layout->seed;
+    CsandSceneColumn column = {
+        .ground = csandSceneGround(layout, x),
+        .coal_offset = layout->coal_spacing * csandSceneNoise1(seed, CSAND_SCENE_SALT_COAL, x, layout->caves_log2 + 1),
+        // and break off every now and then
+        .coal = layout->params->coal && csandSceneNoise1(seed + 1, CSAND_SCENE_SALT_COAL, x, layout->caves_log2) > 0.4f,
+    };
+
+    unsigned int spot = x / layout->tree_spacing;
+    uint32_t hash = csandHashCell(spot, 0, seed, CSAND_SCENE_SALT_TREES);
+    if (!csandHashChance(hash, layout->params->trees)) {
+        return column;
+    }
+
+    // trees stay clear of the edges of their spot, so no column is ever under two of them
+    unsigned int room = layout->tree_spacing - 2 * layout->canopy_radius;
+    unsigned int tree_x = spot * layout->tree_spacing + layout->canopy_radius + (hash >> 16) % room;
+    unsigned int tree_ground = csandSceneGround(layout, tree_x);
+    unsigned int tree_top = tree_ground + layout->trunk_height;
+    unsigned int radius = layout->canopy_radius;
+    // trees only grow on dry land and have to fit
+    if (tree_ground < layout->sea_level || tree_top + radius >= layout->height) {
+        return column;
+    }
+
+    unsigned int dx = x >= tree_x ? x - tree_x : tree_x - x;
+    if (dx > radius) {
+        return column;
+    }
+
+    // the canopy is round, this is how far it reaches up and down from the top of the trunk
+    unsigned int reach = radius;
+    while (dx * dx + reach * reach > radius * radius) {
+        reach--;
+    }
+
+    column.wood_start = dx <= layout->trunk_radius ? tree_ground : tree_top - reach;
+    column.wood_end = tree_top + reach + 1;
+    return column;
+}
+
+static void csandSceneFillChunk(const CsandSceneLayout *layout, CsandChunk *chunk) {
+    const CsandSceneParams *params = layout->params;
+
+    // only the part of the chunk inside the scene, in scene coordinates
+    unsigned int chunk_x = chunk->x << CSAND_CHUNK_SIZE_LOG2;
+    unsigned int chunk_y = chunk->y << CSAND_CHUNK_SIZE_LOG2;
+    unsigned int start_x = csandUiMax(chunk_x, layout->x) - layout->x;
+    unsigned int start_y = csandUiMax(chunk_y, layout->y) - layout->y;
+    unsigned int end_x = csandUiMin(chunk_x + CSAND_CHUNK_SIZE, layout->x + layout->width) - layout->x;
+    unsigned int end_y = csandUiMin(chunk_y + CSAND_CHUNK_SIZE, layout->y + layout->height) - layout->y;
+    unsigned int width = end_x - start_x;
+    unsigned int height = end_y - start_y;
+
+    CsandSceneColumn columns[CSAND_CHUNK_SIZE];
+    for (unsigned int i = 0; i < width; i++) {
+        columns[i] = csandSceneColumn(layout, start_x + i);
+    }
+
+    // caves get a second, finer octave so their walls aren't as smooth
+    CsandSceneNoise caves;
+    CsandSceneNoise caves_detail;
+    CsandSceneNoise hydrogen;
+    uint32_t seed = layout->seed;
+    csandSceneNoiseInit(&caves, seed, CSAND_SCENE_SALT_CAVES, layout->caves_log2, start_x, start_y, width, height);
+    csandSceneNoiseInit(&caves_detail, seed + 1, CSAND_SCENE_SALT_CAVES, layout->caves_log2 - 1, start_x, start_y, width, height);
+    csandSceneNoiseInit(&hydrogen, seed, CSAND_SCENE_SALT_HYDROGEN, layout->caves_log2, start_x, start_y, width, height);
+    unsigned int coal_mask = layout->coal_spacing - 1;
+
+    // the noise is mostly around the middle, so even a thin band around it hollows out a lot
+    float cave_band = 0.1f * params->caves;
+
+    // a column at a time, everything above the rock comes in runs of the same material
+    for (unsigned int i = 0; i < width; i++) {
+        const CsandSceneColumn *column = &columns[i];
+        unsigned int x = layout->x + start_x + i;
+        unsigned int rock_end = column->ground - csandUiMin(layout->sand_depth, column->ground);
+        unsigned int y = start_y;
+
+        float caves_column[CSAND_SCENE_LATTICE_SIZE];
+        float caves_detail_column[CSAND_SCENE_LATTICE_SIZE];
+        float hydrogen_column[CSAND_SCENE_LATTICE_SIZE];
+        if (y < rock_end) {
+            csandSceneNoiseColumn(&caves, i, caves_column);
+            csandSceneNoiseColumn(&caves_detail, i, caves_detail_column);
+            csandSceneNoiseColumn(&hydrogen, i, hydrogen_column);
+        }
+
+        for (; y < end_y && y < rock_end; y++) {
+            unsigned int j = y - start_y;
+            unsigned char mat = MAT_WALL;
+            if (y + layout->cave_cover < column->ground) {
+                float cave = 0.7f * csandSceneNoiseAt(&caves, caves_column, j) + 0.3f * csandSceneNoiseAt(&caves_detail, caves_detail_column, j);
+                if (cave > 0.5f - cave_band && cave < 0.5f + cave_band) {
+                    mat = MAT_AIR;
+                } else if (params->hydrogen && y + 2 * layout->cave_cover < column->ground && csandSceneNoiseAt(&hydrogen, hydrogen_column, j) > 0.82f) {
+                    mat = MAT_HYDROGEN_GAS;
+                }
+            }
+            if (mat == MAT_WALL && column->coal && ((y + column->coal_offset) & coal_mask) < layout->coal_thickness) {
+                mat = MAT_COAL;
+            }
+
+            chunk->cells[csandChunkCellIndex(x, layout->y + y)] = mat;
+        }
+
+        for (; y < end_y; y++) {
+            unsigned char mat = MAT_AIR;
+            if (y < column->ground) {
+                mat = MAT_SAND;
+            } else if (y >= column->wood_start && y < column->wood_end) {
+                mat = MAT_WOOD;
+            } else if (y < layout->sea_level) {
+                mat = y + layout->oil_depth >= layout->sea_level ? MAT_OIL : MAT_WATER;
+            }
+
+            chunk->cells[csandChunkCellIndex(x, layout->y + y)] = mat;
+        }
+    }
+}
+
+static void *csandSceneWork(void *arg) {
+    const CsandSceneWork *work = arg;
+    for (size_t i = work->first; i < work->chunks_count; i += work->step) {
+        csandSceneFillChunk(work->layout, work->chunks[i]);
+    }
+
+    return NULL;
+}
+
+#ifdef CSAND_SCENE_THREADS
+static void csandSceneRunThreads(CsandSceneWork *work, unsigned int threads) {
+    if (threads == 0) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = processors > 0 ? processors : 1;
+    }
+    threads = csandUiClamp(threads, 1, CSAND_SCENE_MAX_THREADS);
+
+    pthread_t ids[CSAND_SCENE_MAX_THREADS];
+    CsandSceneWork shares[CSAND_SCENE_MAX_THREADS];
+    bool started[CSAND_SCENE_MAX_THREADS];
+    for (unsigned int i = 0; i < threads; i++) {
+        shares[i] = *work;
+        shares[i].first = i;
+        shares[i].step = threads;
+    }
+
+    // the calling thread takes the first share itself, and any share a thread couldn't be started for
+    for (unsigned int i = 1; i < threads; i++) {
+        started[i] = pthread_create(&ids[i], NULL, csandSceneWork, &shares[i]) == 0;
+    }
+
+    csandSceneWork(&shares[0]);
+    for (unsigned int i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(ids[i], NULL);
+        } else {
+            csandSceneWork(&shares[i]);
+        }
+    }
+}
+#endif
+
+void csandSceneGenerate(CsandWorld *world, CsandScene scene, uint32_t seed, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int threads) {
+    width = csandUiMin(width, world->width - x);
+    height = csandUiMin(height, world->height - y);
+    if (x >= world->width || y >= world->height || width == 0 || height == 0) {
+        return;
+    }
+
+    CsandSceneLayout layout = csandSceneLayout(scene, seed, x, y, width, height);
+
+    // the world can't be touched from other threads, so every chunk is loaded up front
+    unsigned int min_chunk_x = x >> CSAND_CHUNK_SIZE_LOG2;
+    unsigned int min_chunk_y = y >> CSAND_CHUNK_SIZE_LOG2;
+    unsigned int max_chunk_x = (x + width - 1) >> CSAND_CHUNK_SIZE_LOG2;
+    unsigned int max_chunk_y = (y + height - 1) >> CSAND_CHUNK_SIZE_LOG2;
+    size_t chunks_count = (size_t)(max_chunk_x - min_chunk_x + 1) * (max_chunk_y - min_chunk_y + 1);
+    CsandChunk **chunks = malloc(chunks_count * sizeof(CsandChunk *));
+    if (chunks == NULL) {
+        csandPlatformPrintErr("scene: out of memory\n");
+        return;
+    }
+
+    size_t count = 0;
+    for (unsigned int chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++) {
+        for (unsigned int chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++) {
+            chunks[count++] = csandWorldWriteChunk(world, chunk_x, chunk_y);
+        }
+    }
+
+    CsandSceneWork work = {&layout, chunks, chunks_count, 0, 1};
+#ifdef CSAND_SCENE_THREADS
+    csandSceneRunThreads(&work, threads);
+#else
+    (void)threads;
+    csandSceneWork(&work);
+#endif
+    free(chunks);
+
+    // the cells around the scene may not be settled anymore, corners included
+    for (unsigned int i = 0; i < width + 2; i++) {
+        if (csandWorldInBounds(world, x - 1 + i, y - 1)) {
+            csandWorldWake(world, x - 1 + i, y - 1);
+        }
+        if (csandWorldInBounds(world, x - 1 + i, y + height)) {
+            csandWorldWake(world, x - 1 + i, y + height);
+        }
+    }
+    for (unsigned int i = 0; i < height; i++) {
+        if (csandWorldInBounds(world, x - 1, y + i)) {
+            csandWorldWake(world, x - 1, y + i);
+        }
+        if (csandWorldInBounds(world, x + width, y + i)) {
+            csandWorldWake(world, x + width, y + i);
+        }
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef CSAND_SCENE_H
+#define CSAND_SCENE_H
+
+#include "world.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// every scene is the same terrain generator with different proportions, see scene_params in scene.c
+#define CSAND_X_SCENES(x) \
+    /* hills and a sea, with a bit of everything */ \
+    x(LANDSCAPE, "landscape") \
+    /* low islands in a deep ocean under a layer of oil */ \
+    x(OCEAN, "ocean") \
+    /* dry land covered in trees */ \
+    x(FOREST, "forest") \
+    /* deep rock full of caves, coal seams and hydrogen pockets */ \
+    x(CAVES, "caves")
+
+#define CSAND_GEN_SCENE_ENUM_ITEM(id, name) CSAND_SCENE_##id,
+#define CSAND_GEN_SCENE_NAME(id, name) name,
+
+typedef enum {
+    CSAND_X_SCENES(CSAND_GEN_SCENE_ENUM_ITEM)
+    CSAND_SCENES_COUNT,
+} CsandScene;
+
+extern const char *const csand_scene_names[CSAND_SCENES_COUNT];
+
+// false if there's no scene called that
+bool csandSceneFromName(const char *name, CsandScene *scene);
+
+/* Fills the width x height rectangle at x, y with the scene, writing whole
+ * chunks straight into the world. What ends up where only depends on the
+ * seed and the size of the rectangle, not on where it is or how many
+ * threads do the work. 0 threads means one per processor. Threads aren't
+ * available in the web build, it always fills one chunk after another. */
+void csandSceneGenerate(CsandWorld *world, CsandScene scene, uint32_t seed, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int threads);
+
+#endif
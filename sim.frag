@@ -0,0 +1,189 @@
+#version 100
+
+// the hash needs more than mediump can hold once coordinates get big
+#ifdef GL_FRAGMENT_PRECISION_HIGH
+precision highp float;
+#else
+precision mediump float;
+#endif
+
+// the grid before this step, material ids in the red channel
+uniform sampler2D texture;
+// a row of properties per material, see csandRendererGpuSimSetMaterials
+uniform sampler2D materials;
+uniform int materials_count;
+uniform ivec2 world_size;
+// blocks are shifted by this many cells diagonally, alternates between 0 and 1
+uniform int block_offset;
+uniform vec2 seed;
+
+#define KIND_SOLID 0
+#define KIND_POWDER 1
+#define KIND_FLUID 2
+
+// keep in sync with the material enum in csand.c
+#define MAT_AIR 0
+// cells past the edge of the world, they act like walls
+#define MAT_EDGE -1
+
+int getMaterial(vec2 cell) {
+    if (cell.x < 0.0 || cell.y < 0.0 || cell.x >= float(world_size.x) || cell.y >= float(world_size.y)) {
+        return MAT_EDGE;
+    }
+
+    return int(texture2D(texture, (cell + 0.5) / vec2(world_size)).r * 255.0 + 0.5);
+}
+
+vec4 getProperties(int mat, float column) {
+    return texture2D(materials, vec2((column + 0.5) / 3.0, (float(mat) + 0.5) / float(materials_count))) * 255.0;
+}
+
+int getKind(int mat) {
+    return mat == MAT_EDGE ? KIND_SOLID : int(getProperties(mat, 0.0).r + 0.5);
+}
+
+float getDensity(int mat) {
+    return getProperties(mat, 0.0).g;
+}
+
+bool isFire(int mat) {
+    return mat != MAT_EDGE && getProperties(mat, 0.0).b > 0.5;
+}
+
+// probabilities are stored as 16 bits, high byte first
+float getProbability(vec2 bytes) {
+    return (floor(bytes.x + 0.5) * 256.0 + floor(bytes.y + 0.5)) / 65535.0;
+}
+
+// Hash without Sine by Dave Hoskins, MIT licensed
+float hash(vec2 cell, float salt) {
+    vec3 p = fract(vec3(cell + seed, salt) * 0.1031);
+    p += dot(p, p.zyx + 31.32);
+    return fract((p.x + p.y) * p.z);
+}
+
+// like tryIgnite in csand.c, but only the cells right around can be looked at
+bool touchesFireAndAir(vec2 cell) {
+    bool fire = false;
+    bool air = false;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            int mat = getMaterial(cell + vec2(dx, dy));
+            fire = fire || isFire(mat);
+            air = air || mat == MAT_AIR;
+        }
+    }
+
+    return fire && air;
+}
+
+/* Decay, or catching fire. Neither moves anything, so the neighbors can be
+ * read from before the step and every fragment of a block still comes to the
+ * same result. */
+int react(int mat, vec2 cell) {
+    if (mat == MAT_EDGE) {
+        return mat;
+    }
+
+    vec4 props = getProperties(mat, 0.0);
+    vec4 probs = getProperties(mat, 1.0);
+    if (hash(cell, 1.0) < getProbability(probs.rg)) {
+        return int(props.a + 0.5);
+    }
+
+    if (props.b < 0.5 && hash(cell, 2.0) < getProbability(probs.ba) && touchesFireAndAir(cell)) {
+        vec4 burn_mats = getProperties(mat, 2.0);
+        return int((hash(cell, 3.0) < 0.5 ? burn_mats.r : burn_mats.g) + 0.5);
+    }
+
+    return mat;
+}
+
+bool canSink(int top, int bottom) {
+    return getKind(top) != KIND_SOLID && getKind(bottom) != KIND_SOLID && getDensity(top) > getDensity(bottom);
+}
+
+// only fluids flow sideways, into anything lighter that isn't solid
+bool canSpread(int a, int b) {
+    if (getKind(a) == KIND_SOLID || getKind(b) == KIND_SOLID) {
+        return false;
+    }
+
+    float density_a = getDensity(a);
+    float density_b = getDensity(b);
+    return (density_a > density_b && getKind(a) == KIND_FLUID) || (density_b > density_a && getKind(b) == KIND_FLUID);
+}
+
+void swap(inout int a, inout int b) {
+    int tmp = a;
+    a = b;
+    b = tmp;
+}
+
+/* Every fragment works out the whole 2x2 block it belongs to and keeps its
+ * own cell. Blocks never overlap within a step and the randomness only
+ * depends on the position and the seed, so the result doesn't depend on the
+ * order anything runs in. */
+void main(void) {
+    vec2 cell = floor(gl_FragCoord.xy);
+    float offset = float(block_offset);
+    vec2 origin = floor((cell - offset) / 2.0) * 2.0 + offset;
+    vec2 local = cell - origin;
+
+    vec2 bl_cell = origin;
+    vec2 br_cell = origin + vec2(1.0, 0.0);
+    vec2 tl_cell = origin + vec2(0.0, 1.0);
+    vec2 tr_cell = origin + vec2(1.0, 1.0);
+    int bl = getMaterial(bl_cell);
+    int br = getMaterial(br_cell);
+    int tl = getMaterial(tl_cell);
+    int tr = getMaterial(tr_cell);
+
+    bl = react(bl, bl_cell);
+    br = react(br, br_cell);
+    tl = react(tl, tl_cell);
+    tr = react(tr, tr_cell);
+
+    bool moved = false;
+    if (canSink(tl, bl)) {
+        swap(tl, bl);
+        moved = true;
+    }
+    if (canSink(tr, br)) {
+        swap(tr, br);
+        moved = true;
+    }
+
+    // diagonals go in a random order, so neither side is favored
+    if (!moved) {
+        if (hash(origin, 4.0) < 0.5) {
+            if (canSink(tl, br)) {
+                swap(tl, br);
+                moved = true;
+            } else if (canSink(tr, bl)) {
+                swap(tr, bl);
+                moved = true;
+            }
+        } else {
+            if (canSink(tr, bl)) {
+                swap(tr, bl);
+                moved = true;
+            } else if (canSink(tl, br)) {
+                swap(tl, br);
+                moved = true;
+            }
+        }
+    }
+
+    if (!moved && hash(origin, 5.0) < 0.5) {
+        if (canSpread(bl, br)) {
+            swap(bl, br);
+        }
+        if (canSpread(tl, tr)) {
+            swap(tl, tr);
+        }
+    }
+
+    int mat = local.y < 0.5 ? (local.x < 0.5 ? bl : br) : (local.x < 0.5 ? tl : tr);
+    gl_FragColor = vec4(float(mat) / 255.0, 0.0, 0.0, 1.0);
+}
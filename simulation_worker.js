@@ -0,0 +1,23 @@
+import { getNullTerminatedString } from "./memutils.js";
+
+// Runs csandSimulationThread of the threaded build on the memory shared with index.js.
+onmessage = async (event) => {
+    const { module, memory, stack_top } = event.data;
+
+    // the module imports the whole platform, none of which the simulation thread may call
+    const env = {memory: memory};
+    for (const { module: import_module, name, kind } of WebAssembly.Module.imports(module)) {
+        if (import_module === "env" && kind === "function") {
+            env[name] = () => {
+                throw new Error(`${name} called from the simulation thread`);
+            };
+        }
+    }
+    env.csandPlatformPrintErr = (str_ptr) => {
+        console.error(getNullTerminatedString(memory.buffer, str_ptr));
+    };
+
+    const instance = await WebAssembly.instantiate(module, {env: env});
+    instance.exports.__stack_pointer.value = stack_top;
+    instance.exports.csandSimulationThread();
+};
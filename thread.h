@@ -0,0 +1,52 @@
+#ifndef CSAND_THREAD_H
+#define CSAND_THREAD_H
+
+/* Locking for the threaded web build, which runs wasm instances on shared
+ * memory, one per Web Worker. Needs clang with -matomics. The browser main
+ * thread isn't allowed to block, so it may only use the try functions and
+ * csandThreadNotify. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef __wasm_atomics__
+#error "thread.h needs wasm atomics, build with -matomics"
+#endif
+
+typedef struct CsandMutex {
+    // 0 unlocked, 1 locked, 2 locked with someone waiting
+    int32_t state;
+} CsandMutex;
+
+// returns once *addr isn't expected anymore, or after timeout_ns unless it's negative
+static inline void csandThreadWait(int32_t *addr, int32_t expected, int64_t timeout_ns) {
+    __builtin_wasm_memory_atomic_wait32(addr, expected, timeout_ns);
+}
+
+static inline void csandThreadNotify(int32_t *addr) {
+    __builtin_wasm_memory_atomic_notify(addr, UINT32_MAX);
+}
+
+static inline bool csandMutexTryLock(CsandMutex *mutex) {
+    int32_t expected = 0;
+    return __atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// not for the browser main thread
+static inline void csandMutexLock(CsandMutex *mutex) {
+    if (csandMutexTryLock(mutex)) {
+        return;
+    }
+
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        csandThreadWait(&mutex->state, 2, -1);
+    }
+}
+
+static inline void csandMutexUnlock(CsandMutex *mutex) {
+    if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2) {
+        csandThreadNotify(&mutex->state);
+    }
+}
+
+#endif
@@ -1,29 +1,254 @@
-#include <stddef.h>
+#include "wasm_libc.h"
+#include <stdint.h>
 
+#define WASM_PAGE_SIZE (64 * 1024)
+#define HEAP_ALIGNMENT 16
+#define HEAP_MIN_SPLIT 64
+
+#ifdef __wasm_bulk_memory__
+
+/* With bulk memory the builtins lower to single memory.copy and memory.fill
+ * instructions, which the engine runs at native memcpy speed. */
 void *memcpy(void *restrict dst, const void *restrict src, size_t size) {
-    for (size_t i = 0; i < size; i++) {
-        ((char *)dst)[i] = ((char *)src)[i];
+    return __builtin_memcpy(dst, src, size);
+}
+
+void *memmove(void *dst, const void *src, size_t size) {
+    return __builtin_memmove(dst, src, size);
+}
+
+void *memset(void *data, int c, size_t size) {
+    return __builtin_memset(data, c, size);
+}
+
+#else
+
+#ifdef __wasm_simd128__
+typedef uint8_t MemWord __attribute__((vector_size(16)));
+#else
+typedef uint64_t MemWord;
+#endif
+
+// wasm loads and stores don't trap on misaligned addresses, they're only slower
+typedef MemWord UnalignedMemWord __attribute__((aligned(1), may_alias));
+
+#define MEM_WORD_SIZE sizeof(MemWord)
+
+/* no_builtin keeps clang from recognizing the loops below as memcpy and
+ * memset and turning them into calls to themselves. */
+#if defined(__clang__)
+#define MEM_NO_BUILTIN __attribute__((no_builtin))
+#else
+#define MEM_NO_BUILTIN
+#endif
+
+/* Safe for overlapping ranges as long as dst is below src, since every word
+ * is loaded before the store that could overwrite it. */
+MEM_NO_BUILTIN static void memCopyForward(unsigned char *dst, const unsigned char *src, size_t size) {
+    if (size >= MEM_WORD_SIZE) {
+        // aligning the stores is enough to keep the loop fast
+        while ((uintptr_t)dst & (MEM_WORD_SIZE - 1)) {
+            *dst++ = *src++;
+            size--;
+        }
+
+        for (; size >= MEM_WORD_SIZE; size -= MEM_WORD_SIZE) {
+            *(MemWord *)dst = *(const UnalignedMemWord *)src;
+            dst += MEM_WORD_SIZE;
+            src += MEM_WORD_SIZE;
+        }
+    }
+
+    while (size-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+// same as memCopyForward, but for dst above src
+MEM_NO_BUILTIN static void memCopyBackward(unsigned char *dst, const unsigned char *src, size_t size) {
+    dst += size;
+    src += size;
+
+    if (size >= MEM_WORD_SIZE) {
+        while ((uintptr_t)dst & (MEM_WORD_SIZE - 1)) {
+            *--dst = *--src;
+            size--;
+        }
+
+        for (; size >= MEM_WORD_SIZE; size -= MEM_WORD_SIZE) {
+            dst -= MEM_WORD_SIZE;
+            src -= MEM_WORD_SIZE;
+            *(MemWord *)dst = *(const UnalignedMemWord *)src;
+        }
     }
 
+    while (size-- > 0) {
+        *--dst = *--src;
+    }
+}
+
+void *memcpy(void *restrict dst, const void *restrict src, size_t size) {
+    memCopyForward(dst, src, size);
     return dst;
 }
 
 void *memmove(void *dst, const void *src, size_t size) {
     if (src > dst) {
-        memcpy(dst, src, size);
+        memCopyForward(dst, src, size);
     } else if (dst > src) {
-        for (size_t i = size; i-- > 0;) {
-            ((char *)dst)[i] = ((char *)src)[i];
-        }
+        memCopyBackward(dst, src, size);
     }
 
     return dst;
 }
 
-void *memset(void *data, int c, size_t size) {
-    for (size_t i = 0; i < size; i++) {
-        ((unsigned char *)data)[i] = c;
+MEM_NO_BUILTIN void *memset(void *data, int c, size_t size) {
+    unsigned char *dst = data;
+
+    if (size >= MEM_WORD_SIZE) {
+        while ((uintptr_t)dst & (MEM_WORD_SIZE - 1)) {
+            *dst++ = c;
+            size--;
+        }
+
+#ifdef __wasm_simd128__
+        MemWord pattern = (MemWord){0} + (unsigned char)c;
+#else
+        MemWord pattern = (MemWord)0x0101010101010101 * (unsigned char)c;
+#endif
+        for (; size >= MEM_WORD_SIZE; size -= MEM_WORD_SIZE) {
+            *(MemWord *)dst = pattern;
+            dst += MEM_WORD_SIZE;
+        }
+    }
+
+    while (size-- > 0) {
+        *dst++ = c;
     }
 
     return data;
 }
+
+#endif
+
+typedef struct HeapBlock {
+    size_t size;
+    struct HeapBlock *next_free;
+} HeapBlock;
+
+// keeps the memory returned to the caller aligned
+#define HEAP_BLOCK_HEADER_SIZE ((sizeof(HeapBlock) + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1))
+
+static unsigned char *heap_top = NULL;
+static unsigned char *heap_end = NULL;
+static HeapBlock *free_blocks = NULL;
+
+#ifdef __wasm_atomics__
+/* Threads share the heap. A spin lock, since the browser main thread isn't
+ * allowed to wait, and nobody holds it for long. */
+static int heap_lock = 0;
+
+static void heapLock(void) {
+    while (__atomic_exchange_n(&heap_lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&heap_lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void heapUnlock(void) {
+    __atomic_store_n(&heap_lock, 0, __ATOMIC_RELEASE);
+}
+#else
+static void heapLock(void) {}
+static void heapUnlock(void) {}
+#endif
+
+/* The heap only ever uses pages it grew itself, because the JS side grabs
+ * pages past the end of the initial memory for its own use. */
+static void *heapExtend(size_t size) {
+    while ((size_t)(heap_end - heap_top) < size) {
+        size_t missing = size - (heap_end - heap_top);
+        size_t pages = (missing + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
+        size_t old_pages = __builtin_wasm_memory_grow(0, pages);
+        if (old_pages == SIZE_MAX) {
+            return NULL;
+        }
+
+        unsigned char *region = (unsigned char *)(old_pages * WASM_PAGE_SIZE);
+        if (region != heap_end) {
+            // someone else grew the memory in between, so the rest of the old region is wasted
+            heap_top = region;
+        }
+        heap_end = region + pages * WASM_PAGE_SIZE;
+    }
+
+    void *ptr = heap_top;
+    heap_top += size;
+    return ptr;
+}
+
+static void heapPushFree(HeapBlock *block) {
+    block->next_free = free_blocks;
+    free_blocks = block;
+}
+
+static void *heapAlloc(size_t size) {
+    if (size > SIZE_MAX - HEAP_BLOCK_HEADER_SIZE - HEAP_ALIGNMENT) {
+        return NULL;
+    }
+    size = (size + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+
+    for (HeapBlock **link = &free_blocks; *link != NULL; link = &(*link)->next_free) {
+        HeapBlock *block = *link;
+        if (block->size < size) {
+            continue;
+        }
+
+        *link = block->next_free;
+
+        if (block->size - size >= HEAP_BLOCK_HEADER_SIZE + HEAP_MIN_SPLIT) {
+            HeapBlock *rest = (HeapBlock *)((unsigned char *)block + HEAP_BLOCK_HEADER_SIZE + size);
+            rest->size = block->size - size - HEAP_BLOCK_HEADER_SIZE;
+            heapPushFree(rest);
+            block->size = size;
+        }
+
+        return (unsigned char *)block + HEAP_BLOCK_HEADER_SIZE;
+    }
+
+    HeapBlock *block = heapExtend(HEAP_BLOCK_HEADER_SIZE + size);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->size = size;
+    return (unsigned char *)block + HEAP_BLOCK_HEADER_SIZE;
+}
+
+void *malloc(size_t size) {
+    heapLock();
+    void *ptr = heapAlloc(size);
+    heapUnlock();
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void *ptr = malloc(count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+void free(void *ptr) {
+    if (ptr != NULL) {
+        heapLock();
+        heapPushFree((HeapBlock *)((unsigned char *)ptr - HEAP_BLOCK_HEADER_SIZE));
+        heapUnlock();
+    }
+}
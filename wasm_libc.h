@@ -0,0 +1,13 @@
+#ifndef CSAND_WASM_LIBC_H
+#define CSAND_WASM_LIBC_H
+
+#include <stddef.h>
+
+void *memcpy(void *restrict dst, const void *restrict src, size_t size);
+void *memmove(void *dst, const void *src, size_t size);
+void *memset(void *data, int c, size_t size);
+void *malloc(size_t size);
+void *calloc(size_t count, size_t size);
+void free(void *ptr);
+
+#endif
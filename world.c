@@ -0,0 +1,972 @@
+#ifndef __wasm__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "materials.h"
+#include "math.h"
+#include "platform.h"
+#include "world.h"
+#ifdef __wasm__
+#include "wasm_libc.h"
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define CSAND_CHUNK_UNPACKED_SIZE (CSAND_CHUNK_AREA + 2 * CSAND_CHUNK_SIZE * sizeof(uint64_t))
+#define CSAND_WORLD_INITIAL_SLOTS 16
+#define CSAND_PAGE_SLOT_SIZE CSAND_CHUNK_AREA
+
+// blocks per slab for the chunk pools
+#define CSAND_WORLD_CHUNK_POOL_SLAB 256
+#define CSAND_WORLD_CELLS_POOL_SLAB 16
+#define CSAND_WORLD_PACKED_POOL_SLAB 32
+#define CSAND_WORLD_TICK_ARENA_BLOCK (16 * 1024)
+
+// magic, version, width, height and tick, every number a little endian uint32_t
+#define CSAND_SNAPSHOT_MAGIC "CSND"
+#define CSAND_SNAPSHOT_VERSION 1
+#define CSAND_SNAPSHOT_HEADER_SIZE 20
+
+static void *csandWorldCheckAlloc(void *ptr) {
+    if (ptr == NULL) {
+        csandPlatformPrintErr("world: out of memory\n");
+        __builtin_trap();
+    }
+
+    return ptr;
+}
+
+static void *csandWorldAlloc(size_t size) {
+    return csandWorldCheckAlloc(malloc(size));
+}
+
+static void *csandWorldGrowArray(void *array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+    void *new_array = csandWorldAlloc(new_capacity * element_size);
+    if (array != NULL) {
+        memcpy(new_array, array, *capacity * element_size);
+        free(array);
+    }
+
+    *capacity = new_capacity;
+    return new_array;
+}
+
+// like csandWorldGrowArray, but for scratch arrays that only live until the end of the tick
+static void *csandWorldGrowScratch(CsandWorld *world, void *array, size_t *capacity, size_t min_capacity, size_t element_size) {
+    size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+    if (new_capacity < min_capacity) {
+        new_capacity = min_capacity;
+    }
+
+    void *new_array = csandWorldCheckAlloc(csandArenaAlloc(&world->tick_arena, new_capacity * element_size));
+    if (array != NULL) {
+        memcpy(new_array, array, *capacity * element_size);
+    }
+
+    *capacity = new_capacity;
+    return new_array;
+}
+
+// cells and both kinds of flags always live and die together
+static void csandChunkSetCells(CsandChunk *chunk, unsigned char *cells) {
+    chunk->cells = cells;
+    chunk->awake = (uint64_t *)(cells + CSAND_CHUNK_AREA);
+    chunk->sim_flags = chunk->awake + CSAND_CHUNK_SIZE;
+    memset(chunk->sim_flags, 0, CSAND_CHUNK_SIZE * sizeof(uint64_t));
+}
+
+static void csandChunkAllocCells(CsandWorld *world, CsandChunk *chunk) {
+    csandChunkSetCells(chunk, csandWorldCheckAlloc(csandPoolAlloc(&world->cells_pool)));
+}
+
+static void csandChunkFreeCells(CsandWorld *world, CsandChunk *chunk) {
+    csandPoolFree(&world->cells_pool, chunk->cells);
+    chunk->cells = NULL;
+    chunk->awake = NULL;
+    chunk->sim_flags = NULL;
+}
+
+static void csandChunkSettleAll(CsandChunk *chunk) {
+    memset(chunk->awake, 0, CSAND_CHUNK_SIZE * sizeof(uint64_t));
+    chunk->awake_count = 0;
+}
+
+/* Wakes every cell of the chunk that lies inside the world. Cells past the
+ * world edge stay settled forever, so a chunk is at rest exactly when its
+ * awake count drops to 0. */
+static void csandWorldWakeChunk(CsandWorld *world, CsandChunk *chunk) {
+    unsigned int start_x = chunk->x << CSAND_CHUNK_SIZE_LOG2;
+    unsigned int start_y = chunk->y << CSAND_CHUNK_SIZE_LOG2;
+    unsigned int width = csandUiMin(world->width - start_x, CSAND_CHUNK_SIZE);
+    unsigned int height = csandUiMin(world->height - start_y, CSAND_CHUNK_SIZE);
+    uint64_t row_bits = width == CSAND_CHUNK_SIZE ? ~(uint64_t)0 : ((uint64_t)1 << width) - 1;
+
+    for (unsigned int y = 0; y < height; y++) {
+        chunk->awake[y] = row_bits;
+    }
+    chunk->awake_count = width * height;
+}
+
+static bool csandWorldChunkInBounds(const CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    return chunk_x < world->chunks_width && chunk_y < world->chunks_height;
+}
+
+static size_t csandChunkHash(unsigned int chunk_x, unsigned int chunk_y) {
+    uint32_t hash = (uint32_t)chunk_x * 0x9E3779B1u ^ (uint32_t)chunk_y * 0x85EBCA77u;
+    return hash ^ (hash >> 15);
+}
+
+static size_t csandWorldChunkSlot(const CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    size_t mask = world->chunk_slots_count - 1;
+    size_t slot = csandChunkHash(chunk_x, chunk_y) & mask;
+
+    while (world->chunk_slots[slot] != NULL) {
+        const CsandChunk *chunk = world->chunk_slots[slot];
+        if (chunk->x == chunk_x && chunk->y == chunk_y) {
+            break;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+CsandChunk *csandWorldFindChunk(const CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    return world->chunk_slots[csandWorldChunkSlot(world, chunk_x, chunk_y)];
+}
+
+static void csandWorldGrowChunkMap(CsandWorld *world) {
+    CsandChunk **old_slots = world->chunk_slots;
+    size_t old_slots_count = world->chunk_slots_count;
+
+    world->chunk_slots_count *= 2;
+    world->chunk_slots = csandWorldAlloc(world->chunk_slots_count * sizeof(CsandChunk *));
+    memset(world->chunk_slots, 0, world->chunk_slots_count * sizeof(CsandChunk *));
+
+    for (size_t i = 0; i < old_slots_count; i++) {
+        CsandChunk *chunk = old_slots[i];
+        if (chunk != NULL) {
+            world->chunk_slots[csandWorldChunkSlot(world, chunk->x, chunk->y)] = chunk;
+        }
+    }
+
+    free(old_slots);
+}
+
+static CsandChunk *csandWorldCreateChunk(CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    // keep the load factor at 1/2 at most, so probes stay short
+    if ((world->chunks_count + 1) * 2 > world->chunk_slots_count) {
+        csandWorldGrowChunkMap(world);
+    }
+
+    CsandChunk *chunk = csandWorldCheckAlloc(csandPoolAlloc(&world->chunk_pool));
+    memset(chunk, 0, sizeof(CsandChunk));
+    chunk->x = chunk_x;
+    chunk->y = chunk_y;
+    chunk->page_slot = -1;
+    chunk->write_tick = world->tick;
+    chunk->dirty = true;
+
+    csandChunkAllocCells(world, chunk);
+    memset(chunk->cells, 0, CSAND_CHUNK_AREA);
+    csandChunkSettleAll(chunk);
+
+    world->chunk_slots[csandWorldChunkSlot(world, chunk_x, chunk_y)] = chunk;
+    world->chunks_count++;
+
+    return chunk;
+}
+
+// backward shift deletion, so no tombstones are needed
+static void csandWorldRemoveChunkSlot(CsandWorld *world, size_t slot) {
+    size_t mask = world->chunk_slots_count - 1;
+    size_t next = (slot + 1) & mask;
+
+    while (world->chunk_slots[next] != NULL) {
+        const CsandChunk *chunk = world->chunk_slots[next];
+        size_t home = csandChunkHash(chunk->x, chunk->y) & mask;
+
+        // move the entry back unless its home lies cyclically in (slot, next]
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            world->chunk_slots[slot] = world->chunk_slots[next];
+            slot = next;
+        }
+
+        next = (next + 1) & mask;
+    }
+
+    world->chunk_slots[slot] = NULL;
+    world->chunks_count--;
+}
+
+#ifndef __wasm__
+/* Cold chunks are copied into a shared file mapping and their heap memory is
+ * freed, so the kernel can write them back and drop them from memory. */
+struct CsandPageFile {
+    int fd;
+    unsigned char *map;
+    size_t slots_count;
+    size_t slots_used;
+    long *free_slots;
+    size_t free_slots_count;
+    size_t free_slots_capacity;
+};
+
+static long csandPageFileAllocSlot(CsandPageFile *file) {
+    if (file->free_slots_count > 0) {
+        return file->free_slots[--file->free_slots_count];
+    }
+
+    if (file->slots_used == file->slots_count) {
+        size_t new_slots_count = file->slots_count == 0 ? 64 : file->slots_count * 2;
+        if (ftruncate(file->fd, new_slots_count * CSAND_PAGE_SLOT_SIZE) != 0) {
+            csandPlatformPrintErr("world: failed to grow the page file\n");
+            return -1;
+        }
+
+        void *map = mmap(NULL, new_slots_count * CSAND_PAGE_SLOT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file->fd, 0);
+        if (map == MAP_FAILED) {
+            csandPlatformPrintErr("world: failed to map the page file\n");
+            return -1;
+        }
+
+        if (file->map != NULL) {
+            munmap(file->map, file->slots_count * CSAND_PAGE_SLOT_SIZE);
+        }
+
+        file->map = map;
+        file->slots_count = new_slots_count;
+    }
+
+    return file->slots_used++;
+}
+
+static void csandPageFileFreeSlot(CsandPageFile *file, long slot) {
+    if (file->free_slots_count == file->free_slots_capacity) {
+        file->free_slots = csandWorldGrowArray(file->free_slots, &file->free_slots_capacity, sizeof(long));
+    }
+
+    file->free_slots[file->free_slots_count++] = slot;
+}
+
+static const unsigned char *csandPageFileSlot(const CsandPageFile *file, long slot) {
+    return file->map + (size_t)slot * CSAND_PAGE_SLOT_SIZE;
+}
+
+static void csandPageFileClose(CsandPageFile *file) {
+    if (file->map != NULL) {
+        munmap(file->map, file->slots_count * CSAND_PAGE_SLOT_SIZE);
+    }
+
+    close(file->fd);
+    free(file->free_slots);
+    free(file);
+}
+#endif
+
+bool csandWorldEnablePaging(CsandWorld *world, const char *path) {
+#ifdef __wasm__
+    (void)world; (void)path;
+    return false;
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+
+    // the file is only scratch space, nothing in it outlives the process
+    unlink(path);
+
+    CsandPageFile *file = csandWorldAlloc(sizeof(CsandPageFile));
+    memset(file, 0, sizeof(CsandPageFile));
+    file->fd = fd;
+
+    if (world->page_file != NULL) {
+        csandPageFileClose(world->page_file);
+    }
+    world->page_file = file;
+
+    return true;
+#endif
+}
+
+static void csandPackedChunkDecode(const CsandPackedChunk *packed, unsigned char *cells) {
+    for (unsigned int i = 0; i < CSAND_CHUNK_AREA / 2; i++) {
+        unsigned char pair = packed->cells[i];
+        cells[2 * i] = packed->palette[pair & 0xF];
+        cells[2 * i + 1] = packed->palette[pair >> 4];
+    }
+}
+
+static unsigned char csandPackedChunkGetMat(const CsandPackedChunk *packed, unsigned int index) {
+    unsigned char pair = packed->cells[index / 2];
+    return packed->palette[index & 1 ? pair >> 4 : pair & 0xF];
+}
+
+// in the layout of chunk->cells
+static void csandWorldDecodeChunk(const CsandWorld *world, const CsandChunk *chunk, unsigned char *cells) {
+    if (chunk == NULL) {
+        memset(cells, 0, CSAND_CHUNK_AREA);
+    } else if (chunk->cells != NULL) {
+        memcpy(cells, chunk->cells, CSAND_CHUNK_AREA);
+    } else if (chunk->packed != NULL) {
+        csandPackedChunkDecode(chunk->packed, cells);
+    } else {
+#ifndef __wasm__
+        const unsigned char *slot = csandPageFileSlot(world->page_file, chunk->page_slot);
+        if (chunk->paged_packed) {
+            csandPackedChunkDecode((const CsandPackedChunk *)slot, cells);
+        } else {
+            memcpy(cells, slot, CSAND_CHUNK_AREA);
+        }
+#else
+        (void)world;
+#endif
+    }
+}
+
+void csandWorldReadChunk(const CsandWorld *world, const CsandChunk *chunk, unsigned char *cells) {
+    if (CSAND_CHUNK_ROWS_CONTIGUOUS) {
+        csandWorldDecodeChunk(world, chunk, cells);
+        return;
+    }
+
+    unsigned char stored[CSAND_CHUNK_AREA];
+    csandWorldDecodeChunk(world, chunk, stored);
+    for (unsigned int y = 0; y < CSAND_CHUNK_SIZE; y++) {
+        for (unsigned int x = 0; x < CSAND_CHUNK_SIZE; x++) {
+            cells[(y << CSAND_CHUNK_SIZE_LOG2) | x] = stored[csandChunkCellIndex(x, y)];
+        }
+    }
+}
+
+static void csandWorldPageIn(CsandWorld *world, CsandChunk *chunk) {
+#ifndef __wasm__
+    unsigned char *cells = csandWorldCheckAlloc(csandPoolAlloc(&world->cells_pool));
+    csandWorldDecodeChunk(world, chunk, cells);
+    csandPageFileFreeSlot(world->page_file, chunk->page_slot);
+    chunk->page_slot = -1;
+
+    csandChunkSetCells(chunk, cells);
+    csandChunkSettleAll(chunk);
+    chunk->retire_checked = false;
+    world->sim_flags_lost = true;
+
+    if (chunk->paged_awake) {
+        csandWorldWakeChunk(world, chunk);
+    }
+#else
+    (void)world; (void)chunk;
+#endif
+}
+
+static void csandWorldPageOut(CsandWorld *world, CsandChunk *chunk) {
+#ifndef __wasm__
+    long slot = csandPageFileAllocSlot(world->page_file);
+    if (slot < 0) {
+        return;
+    }
+
+    unsigned char *dst = world->page_file->map + (size_t)slot * CSAND_PAGE_SLOT_SIZE;
+    if (chunk->cells != NULL) {
+        memcpy(dst, chunk->cells, CSAND_CHUNK_AREA);
+        chunk->paged_packed = false;
+        chunk->paged_awake = chunk->awake_count != 0;
+        csandChunkFreeCells(world, chunk);
+    } else {
+        memcpy(dst, chunk->packed, sizeof(CsandPackedChunk));
+        chunk->paged_packed = true;
+        chunk->paged_awake = false;
+        csandPoolFree(&world->packed_pool, chunk->packed);
+        chunk->packed = NULL;
+    }
+
+    chunk->page_slot = slot;
+#else
+    (void)world; (void)chunk;
+#endif
+}
+
+static void csandChunkUnpack(CsandWorld *world, CsandChunk *chunk) {
+    CsandPackedChunk *packed = chunk->packed;
+    csandChunkAllocCells(world, chunk);
+    chunk->packed = NULL;
+    csandPackedChunkDecode(packed, chunk->cells);
+    csandPoolFree(&world->packed_pool, packed);
+    csandChunkSettleAll(chunk);
+    chunk->retire_checked = false;
+    world->sim_flags_lost = true;
+}
+
+// fails if the chunk has more distinct materials than fit in the palette
+static bool csandChunkPack(CsandWorld *world, CsandChunk *chunk) {
+    unsigned char palette_index[256];
+    memset(palette_index, 0xFF, sizeof(palette_index));
+    unsigned int palette_size = 0;
+
+    CsandPackedChunk *packed = csandPoolAlloc(&world->packed_pool);
+    if (packed == NULL) {
+        return false;
+    }
+
+    memset(packed->palette, 0, sizeof(packed->palette));
+
+    for (unsigned int i = 0; i < CSAND_CHUNK_AREA; i++) {
+        unsigned char mat = chunk->cells[i];
+        if (palette_index[mat] == 0xFF) {
+            if (palette_size == CSAND_PACKED_CHUNK_PALETTE_SIZE) {
+                csandPoolFree(&world->packed_pool, packed);
+                return false;
+            }
+
+            palette_index[mat] = palette_size;
+            packed->palette[palette_size++] = mat;
+        }
+
+        if (i & 1) {
+            packed->cells[i / 2] |= palette_index[mat] << 4;
+        } else {
+            packed->cells[i / 2] = palette_index[mat];
+        }
+    }
+
+    csandChunkFreeCells(world, chunk);
+    chunk->packed = packed;
+
+    return true;
+}
+
+// returns the chunk unpacked and in memory, creating it if it was all air
+static CsandChunk *csandWorldLoadChunk(CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    CsandChunk *chunk = csandWorldGetChunk(world, chunk_x, chunk_y);
+
+    if (chunk == NULL) {
+        chunk = csandWorldCreateChunk(world, chunk_x, chunk_y);
+    } else if (chunk->page_slot >= 0) {
+        csandWorldPageIn(world, chunk);
+    } else if (chunk->cells == NULL) {
+        csandChunkUnpack(world, chunk);
+    }
+
+    return chunk;
+}
+
+bool csandWorldInit(CsandWorld *world, unsigned int width, unsigned int height, CsandWorldFormat format) {
+    if (width > CSAND_WORLD_MAX_SIZE || height > CSAND_WORLD_MAX_SIZE) {
+        return false;
+    }
+
+    memset(world, 0, sizeof(CsandWorld));
+    world->width = width == CSAND_WORLD_UNBOUNDED ? CSAND_WORLD_MAX_SIZE : width;
+    world->height = height == CSAND_WORLD_UNBOUNDED ? CSAND_WORLD_MAX_SIZE : height;
+    world->chunks_width = (world->width + CSAND_CHUNK_MASK) >> CSAND_CHUNK_SIZE_LOG2;
+    world->chunks_height = (world->height + CSAND_CHUNK_MASK) >> CSAND_CHUNK_SIZE_LOG2;
+    world->format = format;
+
+    csandPoolInit(&world->chunk_pool, sizeof(CsandChunk), CSAND_WORLD_CHUNK_POOL_SLAB, &world->budget);
+    csandPoolInit(&world->cells_pool, CSAND_CHUNK_UNPACKED_SIZE, CSAND_WORLD_CELLS_POOL_SLAB, &world->budget);
+    csandPoolInit(&world->packed_pool, sizeof(CsandPackedChunk), CSAND_WORLD_PACKED_POOL_SLAB, &world->budget);
+    csandArenaInit(&world->tick_arena, CSAND_WORLD_TICK_ARENA_BLOCK, &world->budget);
+
+    world->chunk_slots_count = CSAND_WORLD_INITIAL_SLOTS;
+    world->chunk_slots = calloc(world->chunk_slots_count, sizeof(CsandChunk *));
+    if (world->chunk_slots == NULL) {
+        return false;
+    }
+
+    // bounded worlds simulate everything, unbounded ones nothing until they get a focus
+    if (width != CSAND_WORLD_UNBOUNDED && height != CSAND_WORLD_UNBOUNDED) {
+        world->active = (CsandChunkRect){0, 0, world->chunks_width, world->chunks_height};
+        world->resident = world->active;
+    }
+
+    return true;
+}
+
+void csandWorldDestroy(CsandWorld *world) {
+#ifndef __wasm__
+    if (world->page_file != NULL) {
+        csandPageFileClose(world->page_file);
+    }
+#endif
+
+    csandPoolDestroy(&world->chunk_pool);
+    csandPoolDestroy(&world->cells_pool);
+    csandPoolDestroy(&world->packed_pool);
+    csandArenaDestroy(&world->tick_arena);
+    free(world->chunk_slots);
+    memset(world, 0, sizeof(CsandWorld));
+}
+
+static CsandChunkRect csandWorldExpandRect(const CsandWorld *world, CsandChunkRect rect, unsigned int margin) {
+    return (CsandChunkRect){
+        rect.min_x > margin ? rect.min_x - margin : 0,
+        rect.min_y > margin ? rect.min_y - margin : 0,
+        csandUiMin(rect.max_x + margin, world->chunks_width),
+        csandUiMin(rect.max_y + margin, world->chunks_height),
+    };
+}
+
+void csandWorldSetFocus(CsandWorld *world, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+    CsandChunkRect focus = {
+        x >> CSAND_CHUNK_SIZE_LOG2,
+        y >> CSAND_CHUNK_SIZE_LOG2,
+        ((x + width - 1) >> CSAND_CHUNK_SIZE_LOG2) + 1,
+        ((y + height - 1) >> CSAND_CHUNK_SIZE_LOG2) + 1,
+    };
+
+    world->active = csandWorldExpandRect(world, focus, CSAND_WORLD_ACTIVE_MARGIN);
+    world->resident = csandWorldExpandRect(world, focus, CSAND_WORLD_RESIDENT_MARGIN);
+}
+
+static bool csandChunkRectContains(CsandChunkRect rect, unsigned int chunk_x, unsigned int chunk_y) {
+    return chunk_x >= rect.min_x && chunk_x < rect.max_x && chunk_y >= rect.min_y && chunk_y < rect.max_y;
+}
+
+static void csandWorldLoadNeighborhood(CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (csandWorldChunkInBounds(world, chunk_x + dx, chunk_y + dy)) {
+                csandWorldLoadChunk(world, chunk_x + dx, chunk_y + dy);
+            }
+        }
+    }
+}
+
+/* Collects the awake chunks of one row of the active region into
+ * world->active_row, left to right, and loads everything they can look at.
+ * Chunks woken after their row was gathered wait for the next tick. */
+size_t csandWorldGatherActiveRow(CsandWorld *world, unsigned int chunk_y) {
+    size_t count = 0;
+
+    for (unsigned int chunk_x = world->active.min_x; chunk_x < world->active.max_x; chunk_x++) {
+        CsandChunk *chunk = csandWorldGetChunk(world, chunk_x, chunk_y);
+        if (chunk != NULL && chunk->page_slot >= 0 && chunk->paged_awake) {
+            csandWorldPageIn(world, chunk);
+        }
+
+        if (chunk == NULL || chunk->cells == NULL || chunk->awake_count == 0) {
+            continue;
+        }
+
+        csandWorldLoadNeighborhood(world, chunk_x, chunk_y);
+
+        if (count == world->active_row_capacity) {
+            size_t active_width = world->active.max_x - world->active.min_x;
+            world->active_row = csandWorldGrowScratch(world, world->active_row, &world->active_row_capacity, active_width, sizeof(CsandChunk *));
+        }
+        world->active_row[count++] = chunk;
+    }
+
+    return count;
+}
+
+unsigned char csandWorldGetMat(const CsandWorld *world, unsigned int x, unsigned int y) {
+    const CsandChunk *chunk = csandWorldFindChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+    unsigned int index = csandChunkCellIndex(x, y);
+
+    if (chunk == NULL) {
+        return 0;
+    } else if (chunk->cells != NULL) {
+        return chunk->cells[index];
+    } else if (chunk->packed != NULL) {
+        return csandPackedChunkGetMat(chunk->packed, index);
+    }
+
+#ifndef __wasm__
+    const unsigned char *slot = csandPageFileSlot(world->page_file, chunk->page_slot);
+    return chunk->paged_packed ? csandPackedChunkGetMat((const CsandPackedChunk *)slot, index) : slot[index];
+#else
+    return 0;
+#endif
+}
+
+void csandWorldWake(CsandWorld *world, unsigned int x, unsigned int y) {
+    CsandChunk *chunk = csandWorldLoadChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+
+    unsigned int index = csandChunkFlagIndex(x, y);
+    uint64_t *row = &chunk->awake[index >> CSAND_CHUNK_SIZE_LOG2];
+    uint64_t bit = (uint64_t)1 << (index & CSAND_CHUNK_MASK);
+    if (!(*row & bit)) {
+        *row |= bit;
+        chunk->awake_count++;
+    }
+}
+
+static void csandWorldTouchChunk(CsandWorld *world, CsandChunk *chunk) {
+    chunk->write_tick = world->tick;
+    chunk->retire_checked = false;
+    chunk->dirty = true;
+
+    if (!chunk->touched) {
+        if (world->touched_count == world->touched_capacity) {
+            world->touched = csandWorldGrowScratch(world, world->touched, &world->touched_capacity, 0, sizeof(CsandChunk *));
+        }
+
+        world->touched[world->touched_count++] = chunk;
+        chunk->touched = true;
+    }
+}
+
+static void csandWorldWriteMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat, bool create_around) {
+    CsandChunk *chunk = csandWorldLoadChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2);
+    chunk->cells[csandChunkCellIndex(x, y)] = mat;
+    csandWorldTouchChunk(world, chunk);
+
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            unsigned int nx = x + dx;
+            unsigned int ny = y + dy;
+            if (csandWorldInBounds(world, nx, ny) &&
+                (create_around || csandWorldGetChunk(world, nx >> CSAND_CHUNK_SIZE_LOG2, ny >> CSAND_CHUNK_SIZE_LOG2) != NULL)) {
+                csandWorldWake(world, nx, ny);
+            }
+        }
+    }
+}
+
+void csandWorldSetMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat) {
+    csandWorldWriteMat(world, x, y, mat, true);
+}
+
+void csandWorldMoveMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat) {
+    csandWorldWriteMat(world, x, y, mat, false);
+}
+
+CsandChunk *csandWorldWriteChunk(CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    CsandChunk *chunk = csandWorldLoadChunk(world, chunk_x, chunk_y);
+    csandWorldTouchChunk(world, chunk);
+    csandWorldWakeChunk(world, chunk);
+    memset(chunk->sim_flags, 0, CSAND_CHUNK_SIZE * sizeof(uint64_t));
+    return chunk;
+}
+
+void csandWorldWakeAll(CsandWorld *world) {
+    for (size_t i = 0; i < world->chunk_slots_count; i++) {
+        CsandChunk *chunk = world->chunk_slots[i];
+        if (chunk == NULL) {
+            continue;
+        }
+
+        // no need to pull everything back in, paged out chunks wake once they are loaded
+        if (chunk->page_slot >= 0) {
+            chunk->paged_awake = true;
+            continue;
+        }
+
+        if (chunk->cells == NULL) {
+            csandChunkUnpack(world, chunk);
+        }
+
+        csandWorldWakeChunk(world, chunk);
+        chunk->retire_checked = false;
+    }
+}
+
+static bool csandWorldChunkAtRest(const CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    if (!csandWorldChunkInBounds(world, chunk_x, chunk_y)) {
+        return true;
+    }
+
+    const CsandChunk *chunk = csandWorldFindChunk(world, chunk_x, chunk_y);
+    return chunk == NULL || chunk->cells == NULL || chunk->awake_count == 0;
+}
+
+bool csandWorldIsAsleep(const CsandWorld *world) {
+    for (unsigned int chunk_y = world->active.min_y; chunk_y < world->active.max_y; chunk_y++) {
+        for (unsigned int chunk_x = world->active.min_x; chunk_x < world->active.max_x; chunk_x++) {
+            const CsandChunk *chunk = csandWorldFindChunk(world, chunk_x, chunk_y);
+            if (chunk == NULL) {
+                continue;
+            }
+
+            // paged out chunks remember whether they were awake
+            bool awake = chunk->cells != NULL ? chunk->awake_count != 0 : chunk->page_slot >= 0 && chunk->paged_awake;
+            if (awake) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool csandWorldNeighborhoodAtRest(const CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (!csandWorldChunkAtRest(world, chunk_x + dx, chunk_y + dy)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool csandChunkIsAir(const CsandChunk *chunk) {
+    for (unsigned int i = 0; i < CSAND_CHUNK_AREA; i++) {
+        if (chunk->cells[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Drops, packs or pages out a chunk that has been left alone for long enough.
+ * Returns true if the chunk was dropped from the map. */
+static bool csandWorldRetireChunk(CsandWorld *world, CsandChunk *chunk, size_t slot) {
+    unsigned int idle_ticks = world->tick - chunk->write_tick;
+
+    bool can_retire = chunk->cells != NULL &&
+        !chunk->retire_checked &&
+        idle_ticks >= CSAND_CHUNK_PACK_DELAY &&
+        chunk->awake_count == 0 &&
+        csandWorldNeighborhoodAtRest(world, chunk->x, chunk->y);
+
+    if (can_retire) {
+        chunk->retire_checked = true;
+
+        if (csandChunkIsAir(chunk)) {
+            for (unsigned int i = 0; i < CSAND_WORLD_CHUNK_CACHE_SIZE; i++) {
+                if (world->chunk_cache[i] == chunk) {
+                    world->chunk_cache[i] = NULL;
+                }
+            }
+
+            csandWorldRemoveChunkSlot(world, slot);
+            csandChunkFreeCells(world, chunk);
+            csandPoolFree(&world->chunk_pool, chunk);
+            world->chunks_removed = true;
+            return true;
+        }
+
+        if (world->format == CSAND_WORLD_FORMAT_PACKED) {
+            // too many materials keeps it unpacked until the next write
+            csandChunkPack(world, chunk);
+        }
+    }
+
+    bool can_page_out = world->page_file != NULL &&
+        chunk->page_slot < 0 &&
+        idle_ticks >= CSAND_CHUNK_PAGE_OUT_DELAY &&
+        !csandChunkRectContains(world->resident, chunk->x, chunk->y);
+
+    if (can_page_out) {
+        csandWorldPageOut(world, chunk);
+    }
+
+    return false;
+}
+
+/* For worlds big enough that the TLB can't keep up. Cells and their awake
+ * flags go in huge pages, and so do the chunks themselves, which get looked
+ * at just as often. Has to come before anything is written to the world. */
+bool csandWorldEnableHugePages(CsandWorld *world) {
+    if (!csandPoolUseHugePages(&world->cells_pool)) {
+        return false;
+    }
+
+    csandPoolUseHugePages(&world->chunk_pool);
+    return true;
+}
+
+void csandWorldSetMemoryLimit(CsandWorld *world, size_t limit) {
+    world->budget.limit = limit;
+}
+
+void csandWorldEndTick(CsandWorld *world) {
+    for (size_t i = 0; i < world->touched_count; i++) {
+        world->touched[i]->touched = false;
+    }
+
+    world->touched = NULL;
+    world->touched_count = 0;
+    world->touched_capacity = 0;
+    world->active_row = NULL;
+    world->active_row_capacity = 0;
+    csandArenaReset(&world->tick_arena);
+    world->tick++;
+
+    /* A few slots per tick, so the cost doesn't grow with the size of the
+     * world, unless the memory limit is getting close. Chunk memory can't be
+     * reclaimed in the middle of a tick, so running out there is fatal. */
+    size_t live = world->chunk_pool.blocks_used * world->chunk_pool.block_size +
+        world->cells_pool.blocks_used * world->cells_pool.block_size +
+        world->packed_pool.blocks_used * world->packed_pool.block_size;
+    bool under_pressure = world->budget.limit != 0 && live > world->budget.limit / 4 * 3;
+    size_t slots = under_pressure ? world->chunk_slots_count : csandUlMin(CSAND_WORLD_SWEEP_SLOTS, world->chunk_slots_count);
+    for (size_t i = 0; i < slots; i++) {
+        size_t slot = world->sweep_cursor & (world->chunk_slots_count - 1);
+        CsandChunk *chunk = world->chunk_slots[slot];
+
+        // a removal shifts the next chunk into the same slot
+        if (chunk == NULL || !csandWorldRetireChunk(world, chunk, slot)) {
+            world->sweep_cursor = slot + 1;
+        }
+    }
+}
+
+// everything the pools and the tick arena took from malloc, plus the chunk map
+size_t csandWorldMemoryUsage(const CsandWorld *world) {
+    return world->budget.used + world->chunk_slots_count * sizeof(CsandChunk *);
+}
+
+#ifndef __wasm__
+static void csandSnapshotPutU32(unsigned char *bytes, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t csandSnapshotGetU32(const unsigned char *bytes) {
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static bool csandSnapshotReadHeader(FILE *file, unsigned int *width, unsigned int *height, unsigned int *tick) {
+    unsigned char header[CSAND_SNAPSHOT_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            memcmp(header, CSAND_SNAPSHOT_MAGIC, 4) != 0 ||
+            csandSnapshotGetU32(header + 4) != CSAND_SNAPSHOT_VERSION) {
+        return false;
+    }
+
+    *width = csandSnapshotGetU32(header + 8);
+    *height = csandSnapshotGetU32(header + 12);
+    *tick = csandSnapshotGetU32(header + 16);
+    return *width != CSAND_WORLD_UNBOUNDED && *width < CSAND_WORLD_MAX_SIZE &&
+        *height != CSAND_WORLD_UNBOUNDED && *height < CSAND_WORLD_MAX_SIZE;
+}
+#endif
+
+bool csandWorldSave(const CsandWorld *world, const char *path) {
+#ifdef __wasm__
+    (void)world; (void)path;
+    return false;
+#else
+    if (world->width >= CSAND_WORLD_MAX_SIZE || world->height >= CSAND_WORLD_MAX_SIZE) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned char header[CSAND_SNAPSHOT_HEADER_SIZE];
+    memcpy(header, CSAND_SNAPSHOT_MAGIC, 4);
+    csandSnapshotPutU32(header + 4, CSAND_SNAPSHOT_VERSION);
+    csandSnapshotPutU32(header + 8, world->width);
+    csandSnapshotPutU32(header + 12, world->height);
+    csandSnapshotPutU32(header + 16, world->tick);
+    bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    // a row of chunks at a time, so the file can go row by row
+    unsigned char *strip = malloc((size_t)world->width * CSAND_CHUNK_SIZE);
+    ok = ok && strip != NULL;
+    unsigned char cells[CSAND_CHUNK_AREA];
+    for (unsigned int chunk_y = 0; ok && chunk_y < world->chunks_height; chunk_y++) {
+        for (unsigned int chunk_x = 0; chunk_x < world->chunks_width; chunk_x++) {
+            csandWorldReadChunk(world, csandWorldFindChunk(world, chunk_x, chunk_y), cells);
+
+            unsigned int start_x = chunk_x << CSAND_CHUNK_SIZE_LOG2;
+            unsigned int width = csandUiMin(world->width - start_x, CSAND_CHUNK_SIZE);
+            for (unsigned int y = 0; y < CSAND_CHUNK_SIZE; y++) {
+                memcpy(strip + (size_t)y * world->width + start_x, cells + (y << CSAND_CHUNK_SIZE_LOG2), width);
+            }
+        }
+
+        size_t rows = csandUiMin(world->height - (chunk_y << CSAND_CHUNK_SIZE_LOG2), CSAND_CHUNK_SIZE);
+        ok = fwrite(strip, world->width, rows, file) == rows;
+    }
+
+    free(strip);
+    return fclose(file) == 0 && ok;
+#endif
+}
+
+bool csandWorldSnapshotSize(const char *path, unsigned int *width, unsigned int *height) {
+#ifdef __wasm__
+    (void)path; (void)width; (void)height;
+    return false;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned int tick;
+    bool ok = csandSnapshotReadHeader(file, width, height, &tick);
+    fclose(file);
+    return ok;
+#endif
+}
+
+bool csandWorldLoad(CsandWorld *world, const char *path) {
+#ifdef __wasm__
+    (void)world; (void)path;
+    return false;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    unsigned int width;
+    unsigned int height;
+    unsigned int tick;
+    if (!csandSnapshotReadHeader(file, &width, &height, &tick) || width != world->width || height != world->height) {
+        fclose(file);
+        return false;
+    }
+
+    unsigned char *strip = malloc((size_t)width * CSAND_CHUNK_SIZE);
+    bool ok = strip != NULL;
+    for (unsigned int chunk_y = 0; ok && chunk_y < world->chunks_height; chunk_y++) {
+        size_t rows = csandUiMin(height - (chunk_y << CSAND_CHUNK_SIZE_LOG2), CSAND_CHUNK_SIZE);
+        ok = fread(strip, width, rows, file) == rows;
+
+        // anything past the materials would index their tables out of bounds once simulated
+        for (size_t i = 0; ok && i < rows * width; i++) {
+            ok = strip[i] < MATERIALS_COUNT;
+        }
+
+        for (unsigned int chunk_x = 0; ok && chunk_x < world->chunks_width; chunk_x++) {
+            unsigned int start_x = chunk_x << CSAND_CHUNK_SIZE_LOG2;
+            unsigned int chunk_width = csandUiMin(width - start_x, CSAND_CHUNK_SIZE);
+
+            // chunks that are all air are left out, just like they would be after a run
+            bool air = true;
+            for (size_t y = 0; y < rows && air; y++) {
+                for (unsigned int x = 0; x < chunk_width && air; x++) {
+                    air = strip[y * width + start_x + x] == 0;
+                }
+            }
+            if (air && csandWorldFindChunk(world, chunk_x, chunk_y) == NULL) {
+                continue;
+            }
+
+            CsandChunk *chunk = csandWorldWriteChunk(world, chunk_x, chunk_y);
+            for (size_t y = 0; y < rows; y++) {
+                for (unsigned int x = 0; x < chunk_width; x++) {
+                    chunk->cells[csandChunkCellIndex(start_x + x, y)] = strip[y * width + start_x + x];
+                }
+            }
+        }
+    }
+
+    free(strip);
+    fclose(file);
+    if (ok) {
+        world->tick = tick;
+    }
+    return ok;
+#endif
+}
@@ -0,0 +1,259 @@
+#ifndef CSAND_WORLD_H
+#define CSAND_WORLD_H
+
+#include "alloc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// no more than 6, a row of awake flags has to fit in 64 bits
+#define CSAND_CHUNK_SIZE_LOG2 6
+#define CSAND_CHUNK_SIZE (1 << CSAND_CHUNK_SIZE_LOG2)
+#define CSAND_CHUNK_MASK (CSAND_CHUNK_SIZE - 1)
+#define CSAND_CHUNK_AREA (CSAND_CHUNK_SIZE * CSAND_CHUNK_SIZE)
+
+#define CSAND_PACKED_CHUNK_PALETTE_SIZE 16
+// ticks a chunk has to go unwritten before it gets packed or dropped
+#define CSAND_CHUNK_PACK_DELAY 60
+// ticks a chunk outside the resident region has to go unwritten before it pages out
+#define CSAND_CHUNK_PAGE_OUT_DELAY 600
+
+// pass as the width or height to csandWorldInit to get an unbounded axis
+#define CSAND_WORLD_UNBOUNDED 0
+#define CSAND_WORLD_MAX_SIZE (1u << 31)
+
+// chunks around the focus that keep simulating and that never page out
+#define CSAND_WORLD_ACTIVE_MARGIN 2
+#define CSAND_WORLD_RESIDENT_MARGIN 4
+
+// chunk map slots looked at per tick when deciding what to pack, drop or page out
+#define CSAND_WORLD_SWEEP_SLOTS 64
+#define CSAND_WORLD_CHUNK_CACHE_SIZE 16
+
+typedef enum {
+    CSAND_WORLD_FORMAT_BYTE,
+    // chunks at rest are stored with 4 bits per cell
+    CSAND_WORLD_FORMAT_PACKED,
+} CsandWorldFormat;
+
+typedef struct CsandPackedChunk {
+    unsigned char palette[CSAND_PACKED_CHUNK_PALETTE_SIZE];
+    unsigned char cells[CSAND_CHUNK_AREA / 2];
+} CsandPackedChunk;
+
+typedef struct CsandChunk {
+    // position in chunks
+    unsigned int x;
+    unsigned int y;
+    // these are NULL while the chunk is packed or paged out
+    unsigned char *cells;
+    /* The cells that may still do something, a row per word with bit x for
+     * the cell in column x. The rest are settled and can't do anything until
+     * one of their neighbors changes. */
+    uint64_t *awake;
+    /* A bit per cell laid out like the awake flags, free for the simulation
+     * to use. Cleared whenever the cells are loaded or written all at once. */
+    uint64_t *sim_flags;
+    CsandPackedChunk *packed;
+    unsigned int awake_count;
+    unsigned int write_tick;
+    // slot in the page file, or -1 while the chunk is in memory
+    long page_slot;
+    bool paged_packed;
+    bool paged_awake;
+    // written since the last tick ended
+    bool touched;
+    // already found not worth packing or dropping since the last write
+    bool retire_checked;
+    // changed since the renderer last uploaded it
+    bool dirty;
+    // free for the simulation to use, starts out 0
+    unsigned int sim_mark;
+} CsandChunk;
+
+// in chunks, max is exclusive
+typedef struct CsandChunkRect {
+    unsigned int min_x;
+    unsigned int min_y;
+    unsigned int max_x;
+    unsigned int max_y;
+} CsandChunkRect;
+
+typedef struct CsandPageFile CsandPageFile;
+
+typedef struct CsandWorld {
+    unsigned int width;
+    unsigned int height;
+    unsigned int chunks_width;
+    unsigned int chunks_height;
+    CsandWorldFormat format;
+    // open addressing hash map, chunks missing from it are all air
+    CsandChunk **chunk_slots;
+    size_t chunk_slots_count;
+    size_t chunks_count;
+    CsandChunk *chunk_cache[CSAND_WORLD_CHUNK_CACHE_SIZE];
+    CsandMemoryBudget budget;
+    CsandPool chunk_pool;
+    CsandPool cells_pool;
+    CsandPool packed_pool;
+    // scratch that only lives until the end of the tick, active_row and touched included
+    CsandArena tick_arena;
+    // only chunks in here are simulated
+    CsandChunkRect active;
+    // chunks in here never page out
+    CsandChunkRect resident;
+    CsandChunk **active_row;
+    size_t active_row_capacity;
+    CsandChunk **touched;
+    size_t touched_count;
+    size_t touched_capacity;
+    unsigned int tick;
+    size_t sweep_cursor;
+    // set when chunks are dropped from the map, anything caching their contents has to refresh
+    bool chunks_removed;
+    // set when chunks get their cells back from packing or the page file, with their sim flags cleared
+    bool sim_flags_lost;
+    CsandPageFile *page_file;
+} CsandWorld;
+
+bool csandWorldInit(CsandWorld *world, unsigned int width, unsigned int height, CsandWorldFormat format);
+void csandWorldDestroy(CsandWorld *world);
+bool csandWorldEnablePaging(CsandWorld *world, const char *path);
+bool csandWorldEnableHugePages(CsandWorld *world);
+// 0 lifts the limit
+void csandWorldSetMemoryLimit(CsandWorld *world, size_t limit);
+void csandWorldSetFocus(CsandWorld *world, unsigned int x, unsigned int y, unsigned int width, unsigned int height);
+CsandChunk *csandWorldFindChunk(const CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y);
+size_t csandWorldGatherActiveRow(CsandWorld *world, unsigned int chunk_y);
+unsigned char csandWorldGetMat(const CsandWorld *world, unsigned int x, unsigned int y);
+void csandWorldSetMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat);
+/* Like csandWorldSetMat, for cells moved around by the simulation. Missing
+ * chunks next to the cell stay missing, their air has nothing to wake for. */
+void csandWorldMoveMat(CsandWorld *world, unsigned int x, unsigned int y, unsigned char mat);
+/* Loads the chunk for its cells to be written directly, counts it as written,
+ * wakes all of it and clears its sim flags. For filling in lots of cells at
+ * once, cells next to it in other chunks are left for the caller to wake. */
+CsandChunk *csandWorldWriteChunk(CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y);
+void csandWorldWakeAll(CsandWorld *world);
+// writes wake the cells right around, this is for rules that look further than that
+void csandWorldWake(CsandWorld *world, unsigned int x, unsigned int y);
+// true when nothing in the active region can change until something is written to it
+bool csandWorldIsAsleep(const CsandWorld *world);
+void csandWorldEndTick(CsandWorld *world);
+/* Copies the cells of a chunk row by row, whatever state it's in and however
+ * its cells are laid out. Missing chunks are all air. */
+void csandWorldReadChunk(const CsandWorld *world, const CsandChunk *chunk, unsigned char *cells);
+size_t csandWorldMemoryUsage(const CsandWorld *world);
+/* Snapshots hold every cell of a bounded world and its tick, worlds as big
+ * as CSAND_WORLD_MAX_SIZE count as unbounded. None of them work in the web
+ * build. Loading needs a world of the same size, csandWorldSnapshotSize
+ * tells what that is, and fails on cells that aren't materials. */
+bool csandWorldSave(const CsandWorld *world, const char *path);
+bool csandWorldSnapshotSize(const char *path, unsigned int *width, unsigned int *height);
+bool csandWorldLoad(CsandWorld *world, const char *path);
+
+// coordinates that went below zero wrap around and end up out of bounds too
+static inline bool csandWorldInBounds(const CsandWorld *world, unsigned int x, unsigned int y) {
+    return x < world->width && y < world->height;
+}
+
+#ifdef CSAND_TILED_CHUNKS
+/* Cells are stored as 8x8 tiles of a cache line each, so moving up or down
+ * mostly stays within the same line. Rows of a tile are still contiguous,
+ * which is all the span checks in csand.c need. */
+#define CSAND_TILE_SIZE_LOG2 3
+#define CSAND_TILE_MASK ((1 << CSAND_TILE_SIZE_LOG2) - 1)
+#define CSAND_CHUNK_ROWS_CONTIGUOUS false
+
+static inline unsigned int csandChunkCellIndex(unsigned int x, unsigned int y) {
+    unsigned int tile = ((y & CSAND_CHUNK_MASK) >> CSAND_TILE_SIZE_LOG2 << (CSAND_CHUNK_SIZE_LOG2 - CSAND_TILE_SIZE_LOG2)) |
+        ((x & CSAND_CHUNK_MASK) >> CSAND_TILE_SIZE_LOG2);
+    return (tile << (2 * CSAND_TILE_SIZE_LOG2)) | ((y & CSAND_TILE_MASK) << CSAND_TILE_SIZE_LOG2) | (x & CSAND_TILE_MASK);
+}
+#else
+#define CSAND_CHUNK_ROWS_CONTIGUOUS true
+
+static inline unsigned int csandChunkCellIndex(unsigned int x, unsigned int y) {
+    return ((y & CSAND_CHUNK_MASK) << CSAND_CHUNK_SIZE_LOG2) | (x & CSAND_CHUNK_MASK);
+}
+#endif
+
+// awake flags go row by row whatever the layout of the cells
+static inline unsigned int csandChunkFlagIndex(unsigned int x, unsigned int y) {
+    return ((y & CSAND_CHUNK_MASK) << CSAND_CHUNK_SIZE_LOG2) | (x & CSAND_CHUNK_MASK);
+}
+
+// neighboring chunks never share a cache entry
+static inline CsandChunk *csandWorldGetChunk(CsandWorld *world, unsigned int chunk_x, unsigned int chunk_y) {
+    CsandChunk **cached = &world->chunk_cache[((chunk_y & 3) << 2) | (chunk_x & 3)];
+    if (*cached == NULL || (*cached)->x != chunk_x || (*cached)->y != chunk_y) {
+        *cached = csandWorldFindChunk(world, chunk_x, chunk_y);
+    }
+
+    return *cached;
+}
+
+/* Only valid for cells of loaded, unpacked chunks. Chunks being simulated
+ * have their whole neighborhood loaded by csandWorldGatherActiveRow, so the
+ * simulation can use this freely for awake cells and anything within a
+ * chunk of them. */
+static inline unsigned char *csandWorldCell(CsandWorld *world, unsigned int x, unsigned int y) {
+    return csandWorldGetChunk(world, x >> CSAND_CHUNK_SIZE_LOG2, y >> CSAND_CHUNK_SIZE_LOG2)->cells + csandChunkCellIndex(x, y);
+}
+
+static inline bool csandChunkIsAwake(const CsandChunk *chunk, unsigned int index) {
+    return chunk->awake[index >> CSAND_CHUNK_SIZE_LOG2] >> (index & CSAND_CHUNK_MASK) & 1;
+}
+
+static inline void csandChunkSettle(CsandChunk *chunk, unsigned int index) {
+    chunk->awake[index >> CSAND_CHUNK_SIZE_LOG2] &= ~((uint64_t)1 << (index & CSAND_CHUNK_MASK));
+    chunk->awake_count--;
+}
+
+/* Column of the first awake cell of the row at or after column x, or
+ * CSAND_CHUNK_SIZE if there's none. */
+static inline unsigned int csandChunkNextAwake(const CsandChunk *chunk, unsigned int row, unsigned int x) {
+    if (x >= CSAND_CHUNK_SIZE) {
+        return CSAND_CHUNK_SIZE;
+    }
+
+    uint64_t bits = chunk->awake[row] >> x;
+    if (bits == 0) {
+        return CSAND_CHUNK_SIZE;
+    }
+
+#ifdef __GNUC__
+    return x + __builtin_ctzll(bits);
+#else
+    while (!(bits & 1)) {
+        bits >>= 1;
+        x++;
+    }
+    return x;
+#endif
+}
+
+/* Column of the last awake cell of the row at or before column x, or
+ * CSAND_CHUNK_SIZE if there's none. Going below column 0 wraps around, so
+ * that counts as none too. */
+static inline unsigned int csandChunkPrevAwake(const CsandChunk *chunk, unsigned int row, unsigned int x) {
+    if (x >= CSAND_CHUNK_SIZE) {
+        return CSAND_CHUNK_SIZE;
+    }
+
+    uint64_t bits = chunk->awake[row] & (~(uint64_t)0 >> (63 - x));
+    if (bits == 0) {
+        return CSAND_CHUNK_SIZE;
+    }
+
+#ifdef __GNUC__
+    return 63 - __builtin_clzll(bits);
+#else
+    while (!(bits >> x & 1)) {
+        x--;
+    }
+    return x;
+#endif
+}
+
+#endif